@@ -0,0 +1,1028 @@
+/*
+  ==============================================================================
+
+    The distortion chain for one channel, sample by sample: the circuit
+    constants, the biquads and op-amp filter they are discretised into, the
+    clipping curves and their polynomial fit, the envelope follower and the
+    LFO. Engine sets run one per channel; LaneEngine and FreezeModel reuse
+    its constants and curves.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "Tracing.h"
+#include "PerfCounters.h"
+
+
+struct DistortionParameters
+{
+    float gain{   0.5 };
+    float tone{   0.5 };
+    float volume{ 0.5 };
+
+    // How far the input envelope pushes gain up, and how many oversampled
+    // samples pass between two envelope-driven coefficient updates.
+    float envelope{ 0.0 };
+    int   controlInterval{ 16 };
+
+    // Depth of the tempo-synced LFO on gain and tone.
+    float lfoGain{ 0.0 };
+    float lfoTone{ 0.0 };
+
+    // How far the sidechain envelope pushes gain up.
+    float sidechain{ 0.0 };
+};
+
+struct AnalogParameters
+{
+    double A{ 0.f }, B{ 0.f }, C{ 0.f };
+    double D{ 0.f }, E{ 0.f }, F{ 0.f };
+};
+
+struct Biquad
+{
+    // Poles closer than this to z = 1 (low corners at high oversampled rates,
+    // e.g. the 3 Hz BJT high-pass) lose too much to float rounding in both the
+    // coefficients and the DF1 state, so such filters run in double instead.
+    // At 8x 48 kHz the float BJT filter only reaches ~54 dB SNR, ~20 dB at 8x 192 kHz.
+    static constexpr double highPrecisionPoleDistance = 1.0e-3;
+
+    // Samples per step of processBlock: four float lanes fill an SSE/NEON register.
+    static constexpr int blockSize = 4;
+
+    float processSample(float x)
+    {
+        if (highPrecision)
+            return (float)processSampleHighPrecision(x);
+
+        float y  = x * b0 + x1 * b1 + x2 * b2;
+              y -= y1 * a1 + y2 * a2;
+
+        x2 = x1;
+        x1 = x;
+
+        y2 = y1;
+        y1 = y;
+
+        return y;
+    }
+
+    // Same result as calling processSample on every sample (up to rounding),
+    // but blockSize samples at a time with no dependency between them.
+    void processBlock(float* data, int numSamples)
+    {
+        int n = highPrecision ? processLookAhead(lookAheadDouble, x1d, x2d, y1d, y2d, data, numSamples)
+                              : processLookAhead(lookAheadFloat,  x1,  x2,  y1,  y2,  data, numSamples);
+
+        for (; n < numSamples; ++n)
+            data[n] = processSample(data[n]);
+    }
+
+    void setCoefficients(float B0, float B1, float B2, float A1, float A2)
+    {
+        setHighPrecision(false);
+
+        b0 = B0; b1 = B1; b2 = B2;
+                 a1 = A1; a2 = A2;
+
+        computeLookAhead(lookAheadFloat, B0, B1, B2, A1, A2);
+    }
+
+    // Picks single or double precision from the pole positions.
+    void setCoefficients(double B0, double B1, double B2, double A1, double A2)
+    {
+        setHighPrecision(getPoleDistance(A1, A2) < highPrecisionPoleDistance);
+
+        b0 = (float)B0; b1 = (float)B1; b2 = (float)B2;
+                        a1 = (float)A1; a2 = (float)A2;
+
+        b0d = B0; b1d = B1; b2d = B2;
+                  a1d = A1; a2d = A2;
+
+        if (highPrecision)
+            computeLookAhead(lookAheadDouble, B0, B1, B2, A1, A2);
+        else
+            computeLookAhead(lookAheadFloat, B0, B1, B2, A1, A2);
+    }
+
+    void reset()
+    {
+        x1 = 0.f; x2 = 0.f;
+        y1 = 0.f; y2 = 0.f;
+
+        x1d = 0.0; x2d = 0.0;
+        y1d = 0.0; y2d = 0.0;
+    }
+
+    bool isHighPrecision() const { return highPrecision; }
+
+    // Distance from z = 1 of the closest root of z^2 + A1 z + A2. Only poles
+    // near z = 1 are a precision problem; the z = -1 pole the bilinear
+    // transform gives first-order sections cancels against a zero.
+    static double getPoleDistance(double A1, double A2)
+    {
+        double disc = A1 * A1 - 4.0 * A2;
+
+        if (disc < 0.0)
+            return std::hypot(1.0 + 0.5 * A1, 0.5 * std::sqrt(-disc));
+
+        double root = std::sqrt(disc);
+        return std::min(std::abs(1.0 - 0.5 * (-A1 + root)), std::abs(1.0 - 0.5 * (-A1 - root)));
+    }
+
+private:
+
+    // Look-ahead form of the DF1 recursion: every output of a block is a fixed
+    // combination of the block's inputs and the state before it,
+    //   y[k] = sum_j gains[j][k] * x[j] + sum_s gains[blockSize + s][k] * state[s],
+    // with state = x1, x2, y1, y2. The outputs no longer depend on each other,
+    // so the inner loops map straight onto SIMD lanes.
+    template <typename T>
+    struct LookAhead
+    {
+        T gains[blockSize + 4][blockSize]{};
+    };
+
+    template <typename T>
+    static void computeLookAhead(LookAhead<T>& lookAhead, double B0, double B1, double B2, double A1, double A2)
+    {
+        // Column c is the block's response to a unit impulse in input c.
+        for (int c = 0; c < blockSize + 4; ++c)
+        {
+            double in[blockSize]{};
+            double s[4]{};
+
+            if (c < blockSize)
+                in[c] = 1.0;
+            else
+                s[c - blockSize] = 1.0;
+
+            double sx1 = s[0], sx2 = s[1], sy1 = s[2], sy2 = s[3];
+
+            for (int k = 0; k < blockSize; ++k)
+            {
+                double y = B0 * in[k] + B1 * sx1 + B2 * sx2 - A1 * sy1 - A2 * sy2;
+
+                sx2 = sx1;
+                sx1 = in[k];
+
+                sy2 = sy1;
+                sy1 = y;
+
+                lookAhead.gains[c][k] = (T)y;
+            }
+        }
+    }
+
+    // Returns the number of samples processed, a multiple of blockSize.
+    template <typename T>
+    static int processLookAhead(const LookAhead<T>& lookAhead, T& sx1, T& sx2, T& sy1, T& sy2, float* data, int numSamples)
+    {
+        int n = 0;
+
+        for (; n + blockSize <= numSamples; n += blockSize)
+        {
+            T y[blockSize];
+
+            for (int k = 0; k < blockSize; ++k)
+                y[k] = lookAhead.gains[blockSize    ][k] * sx1
+                     + lookAhead.gains[blockSize + 1][k] * sx2
+                     + lookAhead.gains[blockSize + 2][k] * sy1
+                     + lookAhead.gains[blockSize + 3][k] * sy2;
+
+            for (int j = 0; j < blockSize; ++j)
+            {
+                T xj = (T)data[n + j];
+
+                for (int k = 0; k < blockSize; ++k)
+                    y[k] += lookAhead.gains[j][k] * xj;
+            }
+
+            sx1 = (T)data[n + blockSize - 1];
+            sx2 = (T)data[n + blockSize - 2];
+            sy1 = y[blockSize - 1];
+            sy2 = y[blockSize - 2];
+
+            for (int k = 0; k < blockSize; ++k)
+                data[n + k] = (float)y[k];
+        }
+
+        return n;
+    }
+
+    double processSampleHighPrecision(double x)
+    {
+        double y  = x * b0d + x1d * b1d + x2d * b2d;
+               y -= y1d * a1d + y2d * a2d;
+
+        x2d = x1d;
+        x1d = x;
+
+        y2d = y1d;
+        y1d = y;
+
+        return y;
+    }
+
+    // Carries the state over so a coefficient update never clicks.
+    void setHighPrecision(bool shouldBeHighPrecision)
+    {
+        if (shouldBeHighPrecision == highPrecision)
+            return;
+
+        if (shouldBeHighPrecision)
+        {
+            x1d = x1; x2d = x2;
+            y1d = y1; y2d = y2;
+        }
+        else
+        {
+            x1 = (float)x1d; x2 = (float)x2d;
+            y1 = (float)y1d; y2 = (float)y2d;
+        }
+
+        highPrecision = shouldBeHighPrecision;
+    }
+
+    float b0{ 0.f }, b1{ 0.f }, b2{ 0.f };
+    float            a1{ 0.f }, a2{ 0.f };
+    float x1{ 0.f }, x2{ 0.f };
+    float y1{ 0.f }, y2{ 0.f };
+
+    double b0d{ 0.0 }, b1d{ 0.0 }, b2d{ 0.0 };
+    double             a1d{ 0.0 }, a2d{ 0.0 };
+    double x1d{ 0.0 }, x2d{ 0.0 };
+    double y1d{ 0.0 }, y2d{ 0.0 };
+
+    LookAhead<float>  lookAheadFloat;
+    LookAhead<double> lookAheadDouble;
+
+    bool highPrecision{ false };
+};
+
+// Filter is a Biquad or a LaneBiquad.
+template <typename Filter>
+inline void calculateCoefficients(Filter& filter, const AnalogParameters& p, float sampleRate)
+{
+    DISTORTION_PERF_SCOPE("calculateCoefficients");
+
+    double T = 1.0 / sampleRate;
+
+    double b0, b1, b2;
+    double a0, a1, a2;
+
+    double Tsq = T * T;
+
+    b0 = 4 * p.A / Tsq + 2 * p.B / T + p.C;
+    b1 = 2 * p.C - 8 * p.A / Tsq;
+    b2 = p.C + 4 * p.A / Tsq - 2 * p.B / T;
+
+    a0 = 4 * p.D / Tsq + 2 * p.E / T + p.F;
+    a1 = 2 * p.F - 8 * p.D / Tsq;
+    a2 = p.F + 4 * p.D / Tsq - 2 * p.E / T;
+
+    b0 /= a0;
+    b1 /= a0;
+    b2 /= a0;
+
+    a1 /= a0;
+    a2 /= a0;
+
+    filter.setCoefficients(b0, b1, b2, a1, a2);
+}
+
+// Op-amp gain network H(s) = 1 + c s / (s^2 + (a + b) s + ab) as a TPT
+// state-variable filter: y = x + (c / w0) * bandpass. With g = w0 T / 2 it
+// matches the bilinear transform in calculateCoefficients, but the
+// coefficients are cheap enough to recompute per sample and the float state
+// stays within ~130 dB of a double reference even at 8x oversampling.
+struct OpAmpFilter
+{
+    static constexpr float minGain = 0.01f;
+    static constexpr float maxGain = 0.99f;
+
+    // Entries of the control-rate table, spaced evenly in sqrt(gain): the
+    // coefficients are close to linear there, so interpolating 128 entries
+    // stays within 0.5% of the exact values across the whole range.
+    static constexpr int gainTableSize = 128;
+
+    void prepare(double sampleRate)
+    {
+        halfT = 0.5 / sampleRate;
+
+        const float first = std::sqrt(minGain);
+        const float last  = std::sqrt(maxGain);
+
+        for (int i = 0; i <= gainTableSize; ++i)
+        {
+            float root = first + (last - first) * (float)i / (float)gainTableSize;
+            gainTable[(size_t)i] = computeCoefficients(root * root, halfT);
+        }
+
+        tableScale = (float)gainTableSize / (last - first);
+        tableOffset = first;
+    }
+
+    void setGain(float gain)
+    {
+        setCoefficients(computeCoefficients(gain, halfT));
+    }
+
+    // Cheap enough to call every few samples: one sqrt and one divide, no
+    // trig or exp. Only valid after prepare.
+    void setGainInterpolated(float gain)
+    {
+        float position = (std::sqrt(juce::jlimit(minGain, maxGain, gain)) - tableOffset) * tableScale;
+        int index = juce::jlimit(0, gainTableSize - 1, (int)position);
+        float frac = position - (float)index;
+
+        const auto& lo = gainTable[(size_t)index];
+        const auto& hi = gainTable[(size_t)index + 1];
+
+        setCoefficients({ lo.g + frac * (hi.g - lo.g),
+                          lo.k + frac * (hi.k - lo.k),
+                          lo.m + frac * (hi.m - lo.m) });
+    }
+
+    float processSample(float x)
+    {
+        float hp = (x - (k + g) * s1 - s2) * d;
+        float v1 = g * hp;
+        float bp = v1 + s1;
+        s1 = bp + v1;
+        float v2 = g * bp;
+        float lp = v2 + s2;
+        s2 = lp + v2;
+
+        return x + m * bp;
+    }
+
+    void reset()
+    {
+        s1 = s2 = 0.f;
+    }
+
+    struct Coefficients
+    {
+        float g, k, m;
+    };
+
+    static Coefficients computeCoefficients(float gain, double halfT)
+    {
+        double dist = juce::jlimit((double)minGain, (double)maxGain, (double)gain);
+
+        double Rt = dist * 100e3;
+        double Rb = (1.0 - dist) * 100e3 + 4.7e3;
+        double Cz = 1e-6;
+        double Cc = 250e-12;
+        double a = 1 / (Rt * Cc);
+        double b = 1 / (Rb * Cz);
+        double c = 1 / (Rb * Cc);
+
+        double w0 = std::sqrt(a * b);
+
+        return { (float)(w0 * halfT), (float)((a + b) / w0), (float)(c / w0) };
+    }
+
+private:
+    // d is always derived from g and k, so interpolated sets stay consistent.
+    void setCoefficients(const Coefficients& c)
+    {
+        g = c.g;
+        k = c.k;
+        m = c.m;
+        d = 1.f / (1.f + g * (k + g));
+    }
+
+    double halfT{ 0.5 / 44100.0 };
+    float g{ 0.f }, k{ 0.f }, m{ 0.f }, d{ 1.f };
+    float s1{ 0.f }, s2{ 0.f };
+
+    std::array<Coefficients, gainTableSize + 1> gainTable{};
+    float tableScale{ 0.f }, tableOffset{ 0.f };
+};
+
+// Peak follower for envelope-controlled drive, stepped once per control
+// interval with the peak of that interval's input.
+struct EnvelopeFollower
+{
+    static constexpr double attackSeconds  = 0.003;
+    static constexpr double releaseSeconds = 0.08;
+
+    void prepare(double controlRate)
+    {
+        attack  = (float)(1.0 - std::exp(-1.0 / (attackSeconds  * controlRate)));
+        release = (float)(1.0 - std::exp(-1.0 / (releaseSeconds * controlRate)));
+    }
+
+    float process(float peak)
+    {
+        envelope += (peak > envelope ? attack : release) * (peak - envelope);
+        return envelope;
+    }
+
+    void reset()
+    {
+        envelope = 0.f;
+    }
+
+    float attack{ 1.f }, release{ 1.f };
+    float envelope{ 0.f };
+};
+
+// Degree-15 polynomial through the static curve at the Chebyshev nodes of
+// |y| <= inputRange, the op-amp's own swing, so the limiter ahead of it only
+// catches peaks the op-amp would flatten anyway. A degree-N polynomial only
+// makes harmonics up to N times the input frequency; getOversamplingStages
+// picks the least factor that keeps all of them out of the audio band.
+// Inputs are to be limited into the range beforehand; the clamp only catches
+// what gets past. For the op-amp into the diode clipper the fit is within
+// 0.06, the error sitting around zero where the diode curve is steepest;
+// even degrees do worse there. The series is summed in Chebyshev form, which
+// unlike powers of u keeps its precision in float at this degree.
+struct PolynomialShaper
+{
+    static constexpr int degree = 15;
+    static constexpr float inputRange = 4.5f;
+    static constexpr double audioBand = 20000.0;
+
+    explicit PolynomialShaper(float (*curve)(float))
+    {
+        constexpr int numNodes = degree + 1;
+        std::array<double, numNodes> chebyshev{};
+
+        for (int j = 0; j < numNodes; ++j)
+        {
+            const auto theta = juce::MathConstants<double>::pi * (j + 0.5) / numNodes;
+            const auto value = (double)curve((float)(inputRange * std::cos(theta)));
+
+            for (int k = 0; k < numNodes; ++k)
+                chebyshev[(size_t)k] += (k == 0 ? 1.0 : 2.0) / numNodes * value * std::cos(k * theta);
+        }
+
+        for (int k = 0; k < numNodes; ++k)
+            coefficients[(size_t)k] = (float)chebyshev[(size_t)k];
+    }
+
+    // Harmonic N of a tone at f folds back to (factor fs - N f); it stays
+    // above the band as long as factor fs >= (N + 1) f for every f in it.
+    // That is 8x at 44.1 and 48 kHz, 4x at 96 kHz, 2x at 192 kHz and none
+    // at 384 kHz.
+    static int getOversamplingStages(double sampleRate)
+    {
+        const auto band = juce::jmin(audioBand, sampleRate / 2.0);
+        int stages = 0;
+
+        while (sampleRate * (double)(1 << stages) < (degree + 1) * band * 0.999)
+            ++stages;
+
+        return stages;
+    }
+
+    // Clenshaw's recurrence, with T(k+1) = 2u T(k) - T(k-1).
+    float process(float y) const
+    {
+        float u = juce::jlimit(-1.f, 1.f, y * (1.f / inputRange));
+        float b1 = 0.f, b2 = 0.f;
+
+        for (int k = degree; k > 0; --k)
+        {
+            const auto b0 = coefficients[(size_t)k] + 2.f * u * b1 - b2;
+            b2 = b1;
+            b1 = b0;
+        }
+
+        return coefficients[0] + u * b1 - b2;
+    }
+
+    std::array<float, degree + 1> coefficients{};
+};
+
+// Sine LFO written a block at a time. The phase (in cycles) is folded into a
+// triangle and shaped by the 7th-order Taylor polynomial of sin(pi/2 x),
+// which is within 2e-4 of a sine: no transcendental calls and no branches,
+// so the loop vectorizes.
+struct Lfo
+{
+    static void generate(float* dest, int numSamples, double phase, double increment)
+    {
+        const auto start = (float)(phase - std::floor(phase)) + 0.25f;
+        const auto step  = (float)increment;
+
+        for (int n = 0; n < numSamples; ++n)
+        {
+            float p = start + (float)n * step;
+            p -= (float)(int)p;
+
+            float x = 1.f - 2.f * std::abs(2.f * p - 1.f);
+            float x2 = x * x;
+
+            dest[n] = x * (1.5707963f + x2 * (-0.6459641f + x2 * (0.0796926f - x2 * 0.0046818f)));
+        }
+    }
+};
+
+struct DistortionProcessor
+{
+    // Envelope control intervals are powers of two from here up to chunkSize.
+    static constexpr int minControlInterval = 8;
+
+    // Circuit constants and static nonlinearities, shared with LaneEngine.
+    static inline const float bjtGain = std::pow(10, 42.f/20.f);
+    static constexpr float aDiode = 0.405f;
+    static constexpr float bDiode = 3.178f;
+    static constexpr float pi = 3.14159265359f;
+
+    static float saturateOpAmp(float y)
+    {
+        return y > 0 ? 4.55 * std::tanh(y / 4.55) : 4.4 * std::tanh(y / 4.4);
+    }
+
+    static float clipDiodes(float x)
+    {
+        return aDiode * std::atan(x * bDiode);
+    }
+
+    // Whether no sample is NaN or infinite. Either turns x * 0 into NaN, so
+    // one sum covers the block without a branch per sample.
+    static bool allFinite(const float* data, int numSamples)
+    {
+        float sum = 0.f;
+
+        for (int n = 0; n < numSamples; ++n)
+            sum += data[n] * 0.f;
+
+        return sum == 0.f;
+    }
+
+    static inline const PolynomialShaper polynomialShaper{ [](float y) { return clipDiodes(saturateOpAmp(y)); } };
+
+    // Analog prototypes of the filters that do not depend on any parameter.
+    static void getConstFilterParameters(AnalogParameters& bjtP, AnalogParameters& rcP,
+                                         AnalogParameters& toneLpP, AnalogParameters& toneHpP)
+    {
+        // BJT stage
+        double w1 = 2 * pi * 3.f;
+        double w2 = 2 * pi * 600.f;
+        bjtP.A = 1.f;
+        bjtP.B = 0.f;
+        bjtP.C = 0.f;
+        bjtP.D = 1.f;
+        bjtP.E = w1 + w2;
+        bjtP.F = w1 * w2;
+
+        // RC stage
+
+        double R = 2.2e3;
+        double C = 0.01e-6;
+
+        rcP.C = 1.f;
+        rcP.E = R * C;
+        rcP.F = 1.f;
+
+        // Tone stage
+
+        double LpR    = 6.8e3;
+        double LpC    = 0.1e-6;
+        double hpR1   = 2.2e3;
+        double hpR2   = 6.8e3;
+        double hpC    = 0.022e-6;
+        double lpF    = 320.f;
+        double hpF    = 1.16e3;
+        double hpGain = hpR2 / (hpR1 + hpR2);
+
+        toneLpP.C = 1.f;
+        toneLpP.E = 1.f / (2.f * pi * lpF);
+        toneLpP.F = 1.f;
+
+        toneHpP.B = hpGain;
+        toneHpP.E = 1.f;
+        toneHpP.F = 2.f * pi * hpF;
+    }
+
+    DistortionProcessor() = default;
+
+    void setParameters(const DistortionParameters& newParams)
+    {
+        params = newParams;
+    }
+
+    // Replaces the clipping curve with polynomialShaper behind a pre-limiter,
+    // for PolynomialShaper::getOversamplingStages of oversampling.
+    void setPolynomial(bool shouldUsePolynomial)
+    {
+        polynomial = shouldUsePolynomial;
+    }
+
+    void updateParameters(const DistortionParameters& newParams)
+    {
+        if (!juce::approximatelyEqual(newParams.gain, params.gain))
+        {
+            params.gain = newParams.gain;
+            updateOpAmpFilter();
+        }
+
+        params.envelope = newParams.envelope;
+
+        if (newParams.controlInterval != params.controlInterval)
+        {
+            jassert(newParams.controlInterval >= minControlInterval && (int)chunkSize % newParams.controlInterval == 0);
+            params.controlInterval = newParams.controlInterval;
+            updateEnvelopeFollower();
+        }
+
+        params.tone = newParams.tone;
+        params.volume = newParams.volume;
+    }
+
+    float processSample(float inputsSample)
+    {
+        float processedSample = processBJT(inputsSample);
+
+        processedSample = processOpAmp(processedSample);
+
+        processedSample = processClipper(processedSample);
+
+        processedSample = processTone(processedSample);
+
+        float outputSample = processedSample * params.volume;
+
+        return outputSample;
+    }
+
+    // gainModulation and toneModulation, if given, hold one value per sample
+    // of the block and replace params.gain and params.tone. Gain is picked up
+    // once per control interval through the op-amp's coefficient table, tone
+    // per sample in the final mix.
+    void processBlock(juce::dsp::AudioBlock<float>& block,
+                      const float* gainModulation = nullptr,
+                      const float* toneModulation = nullptr)
+    {
+        const auto numCh = block.getNumChannels();
+        const auto numS = block.getNumSamples();
+
+        for (size_t ch = 0; ch < numCh; ++ch)
+        {
+            auto* data = block.getChannelPointer(ch);
+
+            for (size_t start = 0; start < numS; start += chunkSize)
+                processChunk(data + start, (int)juce::jmin(chunkSize, numS - start),
+                             gainModulation != nullptr ? gainModulation + start : nullptr,
+                             toneModulation != nullptr ? toneModulation + start : nullptr);
+
+            // A non-finite input would otherwise stay in the filter state for good.
+            if (!allFinite(data, (int)numS))
+            {
+                reset();
+                std::fill(data, data + numS, 0.f);
+            }
+        }
+    }
+
+    void prepare(double sampleRate_)
+    {
+        jassert(sampleRate_ > 0.0);
+        sampleRate = sampleRate_;
+
+        reset();
+
+        opamp.prepare(sampleRate);
+
+        updateConstFilters();
+        updateOpAmpFilter();
+        updateEnvelopeFollower();
+    }
+
+    // Time for the slowest pole to decay by 60 dB: the op-amp network's Rb/Cz
+    // corner at minimum gain (~1.5 Hz) rings longer than the 3 Hz BJT high-pass.
+    static double getTailLengthSeconds()
+    {
+        double slowestPole = 1.0 / ((100e3 + 4.7e3) * 1e-6);
+        return std::log(1000.0) / slowestPole;
+    }
+
+    void reset()
+    {
+        bjt.     reset();
+        opamp.   reset();
+        rc.      reset();
+        toneLP.  reset();
+        toneHP.  reset();
+        follower.reset();
+        limiter. reset();
+
+        limiterGain = 1.f;
+    }
+
+   #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+    // Times a lone Biquad, each stage and the full chain over a fixed noise
+    // buffer, so the numbers can be compared between builds independently of
+    // what the host feeds in. Runs on a copy, leaving this engine untouched.
+    // With hardwareCounters, each run also reads those.
+    void runKernelBenchmarks(int oversamplingFactor, HardwareCounters* hardwareCounters = nullptr) const
+    {
+        constexpr int numSamples = 4096;
+        constexpr int numRuns = 64;
+
+        std::vector<float> input(numSamples);
+        juce::Random random(0x5eed);
+
+        for (auto& x : input)
+            x = random.nextFloat() * 2.f - 1.f;
+
+        auto bench = *this;
+        auto suffix = "/x" + juce::String(oversamplingFactor);
+        volatile float sink = 0.f;
+
+        auto run = [&](const juce::String& name, auto&& stage)
+        {
+            auto& section = PerfRegistry::getInstance().getSection("kernel/" + name + suffix);
+
+            for (int r = 0; r < numRuns; ++r)
+            {
+                float acc = 0.f;
+                {
+                    const ScopedPerfMeasurement measurement(&section, hardwareCounters);
+
+                    for (auto x : input)
+                        acc += stage(x);
+                }
+                sink = sink + acc;
+            }
+        };
+
+        // Block variants process a copy of the whole buffer per run.
+        std::vector<float> block(input.size());
+
+        auto runBlock = [&](const juce::String& name, auto&& process)
+        {
+            auto& section = PerfRegistry::getInstance().getSection("kernel/" + name + suffix);
+
+            for (int r = 0; r < numRuns; ++r)
+            {
+                std::copy(input.begin(), input.end(), block.begin());
+                {
+                    const ScopedPerfMeasurement measurement(&section, hardwareCounters);
+                    process(block.data(), numSamples);
+                }
+                sink = sink + block.back();
+            }
+        };
+
+        run("Biquad",  [&](float x) { return bench.bjt.processSample(x); });
+        run("BJT",     [&](float x) { return bench.processBJT(x); });
+        run("OpAmp",   [&](float x) { return bench.processOpAmp(x); });
+        run("Clipper", [&](float x) { return bench.processClipper(x); });
+        run("Polynomial", [&](float x) { return polynomialShaper.process(x); });
+        run("Tone",    [&](float x) { return bench.processTone(x); });
+        run("chain",   [&](float x) { return bench.processSample(x); });
+
+        run     ("Biquad/float",       [&](float x) { return bench.rc.processSample(x); });
+        runBlock("Biquad/block",       [&](float* d, int n) { bench.bjt.processBlock(d, n); });
+        runBlock("Biquad/float/block", [&](float* d, int n) { bench.rc.processBlock(d, n); });
+        runBlock("chain/block",        [&](float* d, int n)
+        {
+            for (int start = 0; start < n; start += (int)chunkSize)
+                bench.processChunk(d + start, juce::jmin((int)chunkSize, n - start));
+        });
+
+        std::vector<float> gainRamp(input.size());
+
+        for (size_t n = 0; n < gainRamp.size(); ++n)
+            gainRamp[n] = 0.01f + 0.98f * (float)n / (float)gainRamp.size();
+
+        runBlock("chain/modulated/block", [&](float* d, int n)
+        {
+            for (int start = 0; start < n; start += (int)chunkSize)
+                bench.processChunk(d + start, juce::jmin((int)chunkSize, n - start), gainRamp.data() + start);
+        });
+
+        bench.params.envelope = 0.5f;
+
+        runBlock("chain/envelope/block", [&](float* d, int n)
+        {
+            for (int start = 0; start < n; start += (int)chunkSize)
+                bench.processChunk(d + start, juce::jmin((int)chunkSize, n - start));
+        });
+
+        // Accuracy of the look-ahead form against the plain recursion, from identical state.
+        auto logBlockError = [&](const juce::String& name, const Biquad& filter)
+        {
+            auto scalar = filter, blocked = filter;
+            std::copy(input.begin(), input.end(), block.begin());
+            blocked.processBlock(block.data(), numSamples);
+
+            double maxError = 0.0;
+
+            for (int n = 0; n < numSamples; ++n)
+                maxError = juce::jmax(maxError, (double)std::abs(scalar.processSample(input[(size_t)n]) - block[(size_t)n]));
+
+            juce::Logger::writeToLog("kernel/" + name + suffix + ": max error vs scalar " + juce::String(maxError, 12));
+        };
+
+        logBlockError("Biquad/block",       bjt);
+        logBlockError("Biquad/float/block", rc);
+    }
+   #endif
+
+
+private:
+    DistortionParameters params;
+    Biquad bjt, rc, toneLP, toneHP;
+    OpAmpFilter opamp;
+    EnvelopeFollower follower;
+
+    bool polynomial{ false };
+    EnvelopeFollower limiter;
+    float limiterGain{ 1.f };
+
+    // Set while the op-amp runs on control-rate coefficients instead of params.gain.
+    bool opampModulated{ false };
+
+    AnalogParameters bjtParams, rcParams, toneLpParams, toneHpParams;
+
+    static constexpr size_t chunkSize = 64;
+
+    float sampleRate;
+
+    float processBJT(float x)
+    {
+        float y = bjt.processSample(x);
+        return bjtGain * y;
+    }
+
+    float processOpAmp(float x)
+    {
+        float y = opamp.processSample(x);
+
+        return saturateOpAmp(y);
+    }
+
+    float processClipper(float x)
+    {
+        float xClipped = clipDiodes(x);
+
+        float y = rc.processSample(xClipped);
+
+        return y;
+    }
+
+    // Same chain as processSample, run stage by stage over a short chunk so
+    // the linear filters can use Biquad::processBlock, which works on several
+    // consecutive samples at once even for a single mono channel.
+    void processChunk(float* data, int numSamples, const float* gain = nullptr, const float* tone = nullptr)
+    {
+        // One gain per control interval, taken from the input before any filtering.
+        float controlGains[chunkSize / minControlInterval];
+        const bool controlRateGain = gain != nullptr || params.envelope > 0.f;
+
+        if (controlRateGain)
+        {
+            for (int start = 0, i = 0; start < numSamples; start += params.controlInterval, ++i)
+            {
+                controlGains[i] = gain != nullptr ? gain[start] : params.gain;
+
+                if (params.envelope > 0.f)
+                {
+                    auto range = juce::FloatVectorOperations::findMinAndMax(data + start, juce::jmin(params.controlInterval, numSamples - start));
+                    auto peak = juce::jmax(-range.getStart(), range.getEnd());
+
+                    controlGains[i] += params.envelope * follower.process(peak);
+                }
+            }
+        }
+
+        bjt.processBlock(data, numSamples);
+        juce::FloatVectorOperations::multiply(data, bjtGain, numSamples);
+
+        if (controlRateGain)
+        {
+            for (int start = 0, i = 0; start < numSamples; start += params.controlInterval, ++i)
+            {
+                opamp.setGainInterpolated(controlGains[i]);
+
+                for (int n = start, end = juce::jmin(start + params.controlInterval, numSamples); n < end; ++n)
+                    data[n] = opamp.processSample(data[n]);
+            }
+
+            opampModulated = true;
+        }
+        else
+        {
+            // Modulation just stopped: go back to the exact static coefficients.
+            if (opampModulated)
+            {
+                updateOpAmpFilter();
+                opampModulated = false;
+            }
+
+            for (int n = 0; n < numSamples; ++n)
+                data[n] = opamp.processSample(data[n]);
+        }
+
+        shape(data, numSamples);
+
+        rc.processBlock(data, numSamples);
+
+        float highPassed[chunkSize];
+        std::copy(data, data + numSamples, highPassed);
+
+        toneLP.processBlock(data, numSamples);
+        toneHP.processBlock(highPassed, numSamples);
+
+        if (tone == nullptr)
+        {
+            for (int n = 0; n < numSamples; ++n)
+                data[n] = ((1 - params.tone) * data[n] + params.tone * highPassed[n]) * params.volume;
+        }
+        else
+        {
+            for (int n = 0; n < numSamples; ++n)
+                data[n] = (data[n] + tone[n] * (highPassed[n] - data[n])) * params.volume;
+        }
+    }
+
+    // The static nonlinearity. In polynomial mode, the peak of each control
+    // interval, held by the limiter's release, sets a gain that keeps the
+    // op-amp input inside the fitted range. The gain drops at once at the
+    // start of the interval and only ramps back up, so no sample reaches the
+    // shaper's clamp.
+    void shape(float* data, int numSamples)
+    {
+        if (!polynomial)
+        {
+            for (int n = 0; n < numSamples; ++n)
+                data[n] = clipDiodes(saturateOpAmp(data[n]));
+
+            return;
+        }
+
+        for (int start = 0; start < numSamples; start += params.controlInterval)
+        {
+            const auto length = juce::jmin(params.controlInterval, numSamples - start);
+
+            auto range = juce::FloatVectorOperations::findMinAndMax(data + start, length);
+            auto peak = juce::jmax(-range.getStart(), range.getEnd());
+            auto level = juce::jmax(peak, limiter.process(peak));
+
+            auto target = PolynomialShaper::inputRange / juce::jmax(PolynomialShaper::inputRange, level);
+            limiterGain = juce::jmin(limiterGain, target);
+            auto step = (target - limiterGain) / (float)length;
+
+            for (int n = start; n < start + length; ++n)
+            {
+                limiterGain += step;
+                data[n] = polynomialShaper.process(data[n] * limiterGain);
+            }
+
+            limiterGain = target;
+        }
+    }
+
+    float processTone(float x)
+    {
+        float xLP = toneLP.processSample(x);
+        float xHP = toneHP.processSample(x);
+        float y = (1 - params.tone) * xLP + params.tone * xHP;
+
+        return y;
+    }
+
+    void updateConstFilters()
+    {
+        DISTORTION_PROBE(const_filters__start);
+        DISTORTION_PERF_SCOPE("updateConstFilters");
+
+        getConstFilterParameters(bjtParams, rcParams, toneLpParams, toneHpParams);
+
+        calculateCoefficients(bjt, bjtParams, sampleRate);
+        calculateCoefficients(rc, rcParams, sampleRate);
+        calculateCoefficients(toneLP, toneLpParams, sampleRate);
+        calculateCoefficients(toneHP, toneHpParams, sampleRate);
+
+        DISTORTION_PROBE(const_filters__done);
+    }
+
+    void updateOpAmpFilter()
+    {
+        DISTORTION_PROBE(opamp_filter__start);
+        DISTORTION_PERF_SCOPE("updateOpAmpFilter");
+
+        opamp.setGain(params.gain);
+
+        DISTORTION_PROBE(opamp_filter__done);
+    }
+
+    void updateEnvelopeFollower()
+    {
+        follower.prepare(sampleRate / params.controlInterval);
+        limiter. prepare(sampleRate / params.controlInterval);
+    }
+};
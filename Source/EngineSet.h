@@ -0,0 +1,611 @@
+/*
+  ==============================================================================
+
+    The chains the processor runs: EngineSet for the main track, built for
+    an EngineConfig, MultiBusEngineSet for tracks 2 and up, and the
+    EngineBuilder that builds replacement sets on the shared WorkerPool
+    while the audio thread runs the current one.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Tracing.h"
+#include "DistortionProcessor.h"
+#include "FftOversampler.h"
+#include "FreezeModel.h"
+#include "LaneEngine.h"
+#include "WorkerPool.h"
+
+
+struct EngineConfig
+{
+    double sampleRate{ 0.0 };
+    int numChannels{ 0 };
+    int oversamplingStages{ 0 };
+    int maxBlockSize{ 0 };
+    bool polynomial{ false };
+
+    // FftOversampler instead of the polyphase IIR one, for offline renders.
+    bool fftOversampling{ false };
+
+    // Sets with less oversampler latency than this delay their output to
+    // match, so that switching between them keeps the reported latency.
+    int latencySamples{ 0 };
+
+    bool operator==(const EngineConfig& other) const
+    {
+        return sampleRate         == other.sampleRate
+            && numChannels        == other.numChannels
+            && oversamplingStages == other.oversamplingStages
+            && maxBlockSize       == other.maxBlockSize
+            && polynomial         == other.polynomial
+            && fftOversampling    == other.fftOversampling
+            && latencySamples     == other.latencySamples;
+    }
+
+    bool operator!=(const EngineConfig& other) const { return !(*this == other); }
+
+    // What juce::dsp::Oversampling allocates for this, near enough: one
+    // buffer per stage at that stage's rate. The filter states are tiny.
+    size_t getOversamplerBytes() const
+    {
+        size_t samples = 0;
+
+        for (int stage = 1; stage <= oversamplingStages; ++stage)
+            samples += (size_t)maxBlockSize << stage;
+
+        return samples * (size_t)numChannels * sizeof(float);
+    }
+};
+
+// A fixed delay per channel, for chains with less latency than they report.
+struct LatencyPadding
+{
+    void prepare(int numChannels, int numSamples)
+    {
+        length = juce::jmax(0, numSamples);
+        position = 0;
+
+        buffer.setSize(numChannels, juce::jmax(1, length));
+        buffer.clear();
+    }
+
+    int getLength() const { return length; }
+
+    size_t getAllocatedBytes() const
+    {
+        return (size_t)buffer.getNumChannels() * (size_t)buffer.getNumSamples() * sizeof(float);
+    }
+
+    void process(juce::dsp::AudioBlock<float>& block)
+    {
+        if (length == 0)
+            return;
+
+        const auto numSamples = (int)block.getNumSamples();
+
+        for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
+        {
+            auto* data  = block.getChannelPointer(ch);
+            auto* delay = buffer.getWritePointer((int)ch);
+
+            for (int n = 0, p = position; n < numSamples; ++n)
+            {
+                std::swap(data[n], delay[p]);
+
+                if (++p == length)
+                    p = 0;
+            }
+        }
+
+        position = (position + numSamples) % length;
+    }
+
+private:
+    int length{ 0 };
+    int position{ 0 };
+    juce::AudioBuffer<float> buffer;
+};
+
+// One complete processing chain: the oversampler and one engine per channel.
+// Built off the audio thread and swapped in as a whole, see EngineBuilder.
+struct EngineSet
+{
+    // For swapping sets and for switching Freeze mode over.
+    static constexpr double crossfadeSeconds = 0.01;
+
+    explicit EngineSet(const EngineConfig& engineConfig)
+        : config(engineConfig)
+    {
+        if (config.fftOversampling && config.oversamplingStages > 0)
+        {
+            fftOversampler = std::make_unique<FftOversampler>(config.numChannels, config.oversamplingStages);
+            fftOversampler->initProcessing((size_t)config.maxBlockSize);
+        }
+        else
+        {
+            oversampler = std::make_unique<juce::dsp::Oversampling<float>>(
+                (size_t)config.numChannels,
+                (size_t)config.oversamplingStages,
+                juce::dsp::Oversampling<float>::FilterType::filterHalfBandPolyphaseIIR,
+                true);
+
+            oversampler->initProcessing((size_t)config.maxBlockSize);
+        }
+
+        double ovSampleRate = config.sampleRate * (double)getOversamplingFactor();
+
+        engines.resize((size_t)config.numChannels);
+
+        for (auto& engine : engines)
+        {
+            engine.prepare(ovSampleRate);
+            engine.setPolynomial(config.polynomial);
+        }
+
+        fadeBuffer.setSize(config.numChannels, config.maxBlockSize);
+
+        const auto maxOversampledBlockSize = (size_t)config.maxBlockSize * (size_t)getOversamplingFactor();
+
+        padding.prepare(config.numChannels, config.latencySamples - getOversamplerLatency());
+
+        gainModulation.resize(maxOversampledBlockSize);
+        toneModulation.resize(maxOversampledBlockSize);
+
+        frozen.resize((size_t)config.numChannels);
+        freezeBuffer.resize(maxOversampledBlockSize);
+        freezeFadeLength = juce::jmax(1, juce::roundToInt(ovSampleRate * crossfadeSeconds));
+
+        updateSidechainFollower();
+    }
+
+    int getOversamplingFactor() const
+    {
+        return fftOversampler != nullptr ? (int)fftOversampler->getOversamplingFactor()
+                                         : (int)oversampler->getOversamplingFactor();
+    }
+
+    int getOversamplerLatency() const
+    {
+        return juce::roundToInt(fftOversampler != nullptr ? fftOversampler->getLatencyInSamples()
+                                                          : oversampler->getLatencyInSamples());
+    }
+
+    int getLatencyInSamples() const
+    {
+        return getOversamplerLatency() + padding.getLength();
+    }
+
+    size_t getAllocatedBytes() const
+    {
+        return (fftOversampler != nullptr ? fftOversampler->getAllocatedBytes() : config.getOversamplerBytes())
+             + engines.capacity() * sizeof(DistortionProcessor)
+             + (size_t)fadeBuffer.getNumChannels() * (size_t)fadeBuffer.getNumSamples() * sizeof(float)
+             + padding.getAllocatedBytes()
+             + (gainModulation.capacity() + toneModulation.capacity() + freezeBuffer.capacity()) * sizeof(float)
+             + frozen.capacity() * sizeof(FreezeModel);
+    }
+
+    // Freeze mode: while model is fitted for the current gain, tone and
+    // volume at this set's rate and nothing modulates them, it runs instead
+    // of the engines. nullptr turns that off. Cheap to call every block.
+    void setFreezeModel(const FreezeModel* model)
+    {
+        freezeEnabled = model != nullptr && model->sampleRate == config.sampleRate * (double)getOversamplingFactor();
+
+        if (!freezeEnabled || model->serial == 0 || model->serial == frozen[0].serial)
+            return;
+
+        // A refit of the settings already running would only restart its filters.
+        if (frozen[0].matches(model->params) && frozen[0].sampleRate == model->sampleRate)
+            return;
+
+        for (auto& channel : frozen)
+            channel = *model;
+    }
+
+    void updateParameters(const DistortionParameters& newParams)
+    {
+        const bool intervalChanged = newParams.controlInterval != params.controlInterval;
+        params = newParams;
+
+        if (intervalChanged)
+            updateSidechainFollower();
+
+        for (auto& engine : engines)
+            engine.updateParameters(params);
+    }
+
+    // The block must fit config: at most numChannels channels and maxBlockSize samples.
+    // lfoPhase is the LFO phase at the first sample and lfoIncrement its
+    // advance per input sample, both in cycles. sidechain, if it has
+    // channels, holds the same samples as block at the base rate.
+    void process(juce::dsp::AudioBlock<float>& block, double lfoPhase = 0.0, double lfoIncrement = 0.0,
+                 const juce::dsp::AudioBlock<float>& sidechain = {})
+    {
+        jassert(block.getNumChannels() <= (size_t)config.numChannels);
+        jassert(block.getNumSamples()  <= (size_t)config.maxBlockSize);
+
+        DISTORTION_PROBE1(upsample__start, (int)block.getNumSamples());
+        auto oversampledBlock = fftOversampler != nullptr ? fftOversampler->processSamplesUp(block)
+                                                          : oversampler->processSamplesUp(block);
+        DISTORTION_PROBE(upsample__done);
+
+        DISTORTION_PROBE1(engine__start, (int)oversampledBlock.getNumSamples());
+
+        const auto numOversampled = (int)oversampledBlock.getNumSamples();
+        const float* gain = nullptr;
+        const float* tone = nullptr;
+
+        if (params.lfoGain > 0.f || params.lfoTone > 0.f)
+        {
+            auto* lfo = toneModulation.data();
+            Lfo::generate(lfo, numOversampled, lfoPhase, lfoIncrement / (double)getOversamplingFactor());
+
+            if (params.lfoGain > 0.f)
+            {
+                juce::FloatVectorOperations::multiply(gainModulation.data(), lfo, params.lfoGain, numOversampled);
+                juce::FloatVectorOperations::add(gainModulation.data(), params.gain, numOversampled);
+                gain = gainModulation.data();
+            }
+
+            if (params.lfoTone > 0.f)
+            {
+                juce::FloatVectorOperations::multiply(lfo, params.lfoTone, numOversampled);
+                juce::FloatVectorOperations::add(lfo, params.tone, numOversampled);
+                juce::FloatVectorOperations::clip(lfo, lfo, 0.f, 1.f, numOversampled);
+                tone = lfo;
+            }
+        }
+
+        if (params.sidechain > 0.f && sidechain.getNumChannels() > 0)
+        {
+            if (gain == nullptr)
+                juce::FloatVectorOperations::fill(gainModulation.data(), params.gain, numOversampled);
+
+            addSidechainDrive(sidechain);
+            gain = gainModulation.data();
+        }
+
+        const bool useFrozen = freezeEnabled && frozen[0].matches(params) && gain == nullptr && tone == nullptr
+                               && params.envelope == 0.f && params.sidechain == 0.f;
+
+        // Switching over: the side that takes over starts from silence, unless
+        // it is still running from a switch this one reverses, and the two are
+        // crossfaded across freezeFadeLength samples, over as many blocks.
+        const bool resetIncoming = useFrozen != frozenRunning && freezeFadeRemaining == 0;
+
+        if (useFrozen != frozenRunning)
+        {
+            freezeFadeRemaining = freezeFadeLength - freezeFadeRemaining;
+            frozenRunning = useFrozen;
+        }
+
+        const auto fadeDone = freezeFadeLength - freezeFadeRemaining;
+
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        {
+            auto channelBlock = oversampledBlock.getSingleChannelBlock(channel);
+
+            if (freezeFadeRemaining == 0)
+            {
+                if (useFrozen)
+                {
+                    frozen[channel].processBlock(channelBlock.getChannelPointer(0), numOversampled);
+                }
+                else
+                {
+                    engines[channel].processBlock(channelBlock, gain, tone);
+                }
+
+                continue;
+            }
+
+            auto* data = channelBlock.getChannelPointer(0);
+            std::copy(data, data + numOversampled, freezeBuffer.data());
+
+            if (resetIncoming && useFrozen)
+                frozen[channel].reset();
+            else if (resetIncoming)
+                engines[channel].reset();
+
+            frozen[channel].processBlock(freezeBuffer.data(), numOversampled);
+            engines[channel].processBlock(channelBlock, gain, tone);
+
+            for (int n = 0; n < numOversampled; ++n)
+            {
+                auto g = juce::jmin(1.f, (float)(fadeDone + n + 1) / (float)freezeFadeLength);
+                auto toFrozen = useFrozen ? g : 1.f - g;
+                data[n] += toFrozen * (freezeBuffer[(size_t)n] - data[n]);
+            }
+        }
+
+        freezeFadeRemaining = juce::jmax(0, freezeFadeRemaining - numOversampled);
+
+        DISTORTION_PROBE(engine__done);
+
+        DISTORTION_PROBE(downsample__start);
+
+        if (fftOversampler != nullptr)
+            fftOversampler->processSamplesDown(block);
+        else
+            oversampler->processSamplesDown(block);
+
+        DISTORTION_PROBE(downsample__done);
+
+        padding.process(block);
+    }
+
+    const EngineConfig config;
+
+    // One or the other, see EngineConfig::fftOversampling.
+    std::unique_ptr<juce::dsp::Oversampling<float>> oversampler;
+    std::unique_ptr<FftOversampler> fftOversampler;
+
+    std::vector<DistortionProcessor> engines;
+
+    // Scratch space for running this set on a copy while it is faded out.
+    juce::AudioBuffer<float> fadeBuffer;
+
+    // Per-sample gain and tone targets at the oversampled rate, from the LFO
+    // and the sidechain, shared by all channels.
+    DistortionParameters params;
+    std::vector<float> gainModulation, toneModulation;
+
+private:
+    EnvelopeFollower sidechainFollower;
+
+    // One model per channel, for the filter state; freezeBuffer holds the
+    // model's output while it is crossfaded with the engines'.
+    std::vector<FreezeModel> frozen;
+    std::vector<float> freezeBuffer;
+    bool freezeEnabled{ false };
+    bool frozenRunning{ false };
+    int freezeFadeLength{ 1 };
+    int freezeFadeRemaining{ 0 };
+
+    LatencyPadding padding;
+
+    // Sidechain samples per follower step: one engine control interval.
+    int getSidechainStep() const
+    {
+        return juce::jmax(1, params.controlInterval / getOversamplingFactor());
+    }
+
+    void updateSidechainFollower()
+    {
+        sidechainFollower.prepare(config.sampleRate / getSidechainStep());
+    }
+
+    // Steps the follower with the peak of each control interval of the
+    // sidechain, over all its channels, and adds the result to the gain
+    // targets of the matching oversampled samples. The engines only read
+    // gain at interval starts, so finer steps would buy nothing.
+    void addSidechainDrive(const juce::dsp::AudioBlock<float>& sidechain)
+    {
+        const auto factor = getOversamplingFactor();
+        const auto step = getSidechainStep();
+        const auto numSamples = (int)sidechain.getNumSamples();
+
+        for (int start = 0; start < numSamples; start += step)
+        {
+            const auto length = juce::jmin(step, numSamples - start);
+            float peak = 0.f;
+
+            for (size_t ch = 0; ch < sidechain.getNumChannels(); ++ch)
+            {
+                auto range = juce::FloatVectorOperations::findMinAndMax(sidechain.getChannelPointer(ch) + start, length);
+                peak = juce::jmax(peak, -range.getStart(), range.getEnd());
+            }
+
+            juce::FloatVectorOperations::add(gainModulation.data() + start * factor,
+                                             params.sidechain * sidechainFollower.process(peak),
+                                             length * factor);
+        }
+    }
+};
+
+// Tracks 2 and up in one chain: a single oversampler over all their
+// channels, and a LaneEngine running each channel in its own SIMD lane.
+// Padded to config.latencySamples, the main track's latency.
+struct MultiBusEngineSet
+{
+    explicit MultiBusEngineSet(const EngineConfig& engineConfig)
+        : config(engineConfig)
+    {
+        jassert(config.numChannels > 0 && config.numChannels <= LaneEngine::maxLanes);
+
+        oversampler = std::make_unique<juce::dsp::Oversampling<float>>(
+            (size_t)config.numChannels,
+            (size_t)config.oversamplingStages,
+            juce::dsp::Oversampling<float>::FilterType::filterHalfBandPolyphaseIIR,
+            true);
+
+        oversampler->initProcessing((size_t)config.maxBlockSize);
+
+        lanes.prepare(config.sampleRate * (double)oversampler->getOversamplingFactor(), config.numChannels);
+
+        laneBuffer.setSize(config.numChannels, config.maxBlockSize);
+
+        padding.prepare(config.numChannels, config.latencySamples - juce::roundToInt(oversampler->getLatencyInSamples()));
+    }
+
+    int getLatencyInSamples() const
+    {
+        return juce::roundToInt(oversampler->getLatencyInSamples()) + padding.getLength();
+    }
+
+    size_t getAllocatedBytes() const
+    {
+        return config.getOversamplerBytes()
+             + (size_t)laneBuffer.getNumChannels() * (size_t)laneBuffer.getNumSamples() * sizeof(float)
+             + padding.getAllocatedBytes();
+    }
+
+    // The block must fit config, with channel n feeding lane n.
+    void process(juce::dsp::AudioBlock<float>& block)
+    {
+        jassert(block.getNumChannels() <= (size_t)config.numChannels);
+        jassert(block.getNumSamples()  <= (size_t)config.maxBlockSize);
+
+        auto oversampledBlock = oversampler->processSamplesUp(block);
+
+        float* channels[LaneEngine::maxLanes];
+
+        for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
+            channels[ch] = oversampledBlock.getChannelPointer(ch);
+
+        lanes.process(channels, (int)block.getNumChannels(), (int)oversampledBlock.getNumSamples());
+
+        oversampler->processSamplesDown(block);
+
+        padding.process(block);
+    }
+
+    const EngineConfig config;
+    std::unique_ptr<juce::dsp::Oversampling<float>> oversampler;
+    LaneEngine lanes;
+
+    // The track inputs, gathered one channel per lane. Output buses can share
+    // the host's channels with other tracks' inputs, so they cannot be
+    // processed in place.
+    juce::AudioBuffer<float> laneBuffer;
+
+private:
+    LatencyPadding padding;
+};
+
+// Builds EngineSets on the shared WorkerPool so the processor can change its
+// configuration without the host calling prepareToPlay, and deletes the sets
+// the audio thread has finished with. The audio thread only uses request(),
+// takeBuilt() and retire(), which never allocate or wait.
+class EngineBuilder
+{
+public:
+    EngineBuilder() = default;
+
+    ~EngineBuilder()
+    {
+        pool->removeJob(buildJob);
+        pool->removeJob(collectJob);
+
+        delete built.exchange(nullptr);
+        delete retired.exchange(nullptr);
+    }
+
+    // For prepareToPlay: builds synchronously and discards anything still in flight.
+    std::unique_ptr<EngineSet> buildNow(const EngineConfig& config)
+    {
+        discard();
+        pool->start();
+
+        return std::make_unique<EngineSet>(config);
+    }
+
+    // For releaseResources: drops requested, built and retired sets.
+    void discard()
+    {
+        {
+            const juce::ScopedLock sl(publishLock);
+
+            ++generation;
+            requestPending.store(false);
+            delete built.exchange(nullptr);
+        }
+
+        delete retired.exchange(nullptr);
+    }
+
+    void request(const EngineConfig& config)
+    {
+        requestedSampleRate.store(config.sampleRate);
+        requestedNumChannels.store(config.numChannels);
+        requestedStages.store(config.oversamplingStages);
+        requestedBlockSize.store(config.maxBlockSize);
+        requestedPolynomial.store(config.polynomial);
+        requestedFftOversampling.store(config.fftOversampling);
+        requestedLatency.store(config.latencySamples);
+        requestPending.store(true, std::memory_order_release);
+
+        pool->addJob(buildJob, WorkerPool::high);
+    }
+
+    // Also queues again what the pool had no room for earlier.
+    std::unique_ptr<EngineSet> takeBuilt()
+    {
+        if (requestPending.load())
+            pool->addJob(buildJob, WorkerPool::high);
+
+        if (retired.load() != nullptr)
+            pool->addJob(collectJob, WorkerPool::low);
+
+        return std::unique_ptr<EngineSet>(built.exchange(nullptr));
+    }
+
+    // Hands a set over for deletion. Fails, leaving the set with the caller,
+    // while the previous one has not been collected yet.
+    bool retire(std::unique_ptr<EngineSet>& set)
+    {
+        EngineSet* expected = nullptr;
+
+        if (!retired.compare_exchange_strong(expected, set.get()))
+            return false;
+
+        set.release();
+        pool->addJob(collectJob, WorkerPool::low);
+
+        return true;
+    }
+
+private:
+    // On a worker.
+    void build()
+    {
+        if (!requestPending.exchange(false, std::memory_order_acquire))
+            return;
+
+        EngineConfig config;
+        config.sampleRate         = requestedSampleRate.load();
+        config.numChannels        = requestedNumChannels.load();
+        config.oversamplingStages = requestedStages.load();
+        config.maxBlockSize       = requestedBlockSize.load();
+        config.polynomial         = requestedPolynomial.load();
+        config.fftOversampling    = requestedFftOversampling.load();
+        config.latencySamples     = requestedLatency.load();
+
+        const auto buildGeneration = generation.load();
+        auto set = std::make_unique<EngineSet>(config);
+
+        const juce::ScopedLock sl(publishLock);
+
+        // prepareToPlay ran while building, so this set is already stale.
+        if (buildGeneration != generation.load())
+            return;
+
+        delete built.exchange(set.release());
+    }
+
+    juce::SharedResourcePointer<WorkerPool> pool;
+    WorkerPool::Job buildJob{ [this] { build(); } };
+    WorkerPool::Job collectJob{ [this] { delete retired.exchange(nullptr); } };
+
+    juce::CriticalSection publishLock;
+    std::atomic<int> generation{ 0 };
+
+    std::atomic<bool> requestPending{ false };
+    std::atomic<double> requestedSampleRate{ 0.0 };
+    std::atomic<int> requestedNumChannels{ 0 }, requestedStages{ 0 }, requestedBlockSize{ 0 }, requestedLatency{ 0 };
+    std::atomic<bool> requestedPolynomial{ false }, requestedFftOversampling{ false };
+
+    std::atomic<EngineSet*> built{ nullptr };
+    std::atomic<EngineSet*> retired{ nullptr };
+
+    JUCE_DECLARE_NON_COPYABLE(EngineBuilder)
+};
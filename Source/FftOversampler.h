@@ -0,0 +1,406 @@
+/*
+  ==============================================================================
+
+    The linear-phase oversampler that engine sets use for offline renders
+    when the OfflineFft parameter is on.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <complex>
+#include <vector>
+
+#include "PerfCounters.h"
+
+
+// Linear-phase oversampling for offline renders: Kaiser-windowed sinc
+// filters applied by overlap-save FFT convolution, a hop of base-rate
+// samples at a time. Upsampling zero-stuffs in the frequency domain (the
+// spectrum of a base-rate segment, repeated) and downsampling decimates
+// there (the oversampled spectrum, folded), so each hop costs one FFT at each
+// rate per direction. The passband runs to 0.45 times the base rate and
+// everything that could land below that is down by 100 dB, where the
+// polyphase IIR filters have a wider transition and non-linear phase. The
+// price is latency: a hop of buffering and half a filter each way.
+// Same calls as juce::dsp::Oversampling, as far as EngineSet uses them.
+class FftOversampler
+{
+public:
+    // Filter half-length and FFT size in base-rate samples.
+    static constexpr int halfLength = 64;
+    static constexpr int baseFftOrder = 10;
+    static constexpr int baseFftSize = 1 << baseFftOrder;
+    static constexpr int hopSize = baseFftSize - 2 * halfLength;
+
+    static constexpr int latencySamples = 2 * (hopSize + halfLength);
+
+    FftOversampler(int channels, int stages)
+        : numChannels(channels),
+          factor(1 << stages),
+          baseFft(baseFftOrder),
+          oversampledFft(baseFftOrder + stages)
+    {
+        jassert(stages > 0);
+
+        const auto size = baseFftSize * factor;
+        const auto centre = halfLength * factor;
+
+        // 100 dB Kaiser window; the -6 dB point halfway between passband and base Nyquist.
+        const auto beta = 0.1102 * (100.0 - 8.7);
+        const auto cutoff = juce::MathConstants<double>::pi * 0.95 / (double)factor;
+
+        std::vector<float> impulse((size_t)size * 2, 0.f);
+
+        for (int n = 0; n <= 2 * centre; ++n)
+        {
+            auto t = (double)(n - centre);
+            auto r = t / (double)centre;
+            auto window = besselI0(beta * std::sqrt(juce::jmax(0.0, 1.0 - r * r))) / besselI0(beta);
+            auto sinc = n == centre ? cutoff / juce::MathConstants<double>::pi
+                                    : std::sin(cutoff * t) / (juce::MathConstants<double>::pi * t);
+
+            impulse[(size_t)n] = (float)(sinc * window);
+        }
+
+        oversampledFft.performRealOnlyForwardTransform(impulse.data(), true);
+
+        filter.resize((size_t)size / 2 + 1);
+
+        for (size_t k = 0; k < filter.size(); ++k)
+            filter[k] = { impulse[2 * k], impulse[2 * k + 1] };
+
+        baseWork.resize((size_t)baseFftSize * 2);
+        oversampledWork.resize((size_t)size * 2);
+    }
+
+    void initProcessing(size_t maxBlockSize)
+    {
+        const auto size = baseFftSize * factor;
+
+        upInput.setSize(numChannels, baseFftSize);
+        upOutput.setSize(numChannels, (hopSize + (int)maxBlockSize) * factor);
+        downInput.setSize(numChannels, size);
+        downOutput.setSize(numChannels, hopSize + (int)maxBlockSize);
+        oversampledBuffer.setSize(numChannels, (int)maxBlockSize * factor);
+
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto* buffer : { &upInput, &upOutput, &downInput, &downOutput, &oversampledBuffer })
+            buffer->clear();
+
+        // The output FIFOs start a hop ahead, which is their share of the latency.
+        upFill = 2 * halfLength;
+        upAvailable = hopSize * factor;
+        downFill = 2 * halfLength * factor;
+        downAvailable = hopSize;
+    }
+
+    size_t getOversamplingFactor() const { return (size_t)factor; }
+    float getLatencyInSamples() const    { return (float)latencySamples; }
+
+    size_t getAllocatedBytes() const
+    {
+        size_t samples = baseWork.size() + oversampledWork.size() + filter.size() * 2;
+
+        for (auto* buffer : { &upInput, &upOutput, &downInput, &downOutput, &oversampledBuffer })
+            samples += (size_t)buffer->getNumChannels() * (size_t)buffer->getNumSamples();
+
+        return samples * sizeof(float);
+    }
+
+    juce::dsp::AudioBlock<float> processSamplesUp(const juce::dsp::AudioBlock<const float>& block)
+    {
+        const auto numSamples = (int)block.getNumSamples();
+        const auto channels = (int)block.getNumChannels();
+
+        for (int done = 0; done < numSamples;)
+        {
+            const auto length = juce::jmin(numSamples - done, baseFftSize - upFill);
+
+            for (int ch = 0; ch < channels; ++ch)
+                std::copy(block.getChannelPointer((size_t)ch) + done, block.getChannelPointer((size_t)ch) + done + length,
+                          upInput.getWritePointer(ch, upFill));
+
+            upFill += length;
+            done += length;
+
+            if (upFill == baseFftSize)
+            {
+                for (int ch = 0; ch < channels; ++ch)
+                    upsampleHop(ch);
+
+                upAvailable += hopSize * factor;
+                upFill = 2 * halfLength;
+            }
+        }
+
+        const auto numOversampled = numSamples * factor;
+
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            auto* fifo = upOutput.getWritePointer(ch);
+            std::copy(fifo, fifo + numOversampled, oversampledBuffer.getWritePointer(ch));
+            std::copy(fifo + numOversampled, fifo + upAvailable, fifo);
+        }
+
+        upAvailable -= numOversampled;
+
+        return juce::dsp::AudioBlock<float>(oversampledBuffer).getSubsetChannelBlock(0, (size_t)channels)
+                                                              .getSubBlock(0, (size_t)numOversampled);
+    }
+
+    // Takes the oversampled samples from the block processSamplesUp returned.
+    void processSamplesDown(juce::dsp::AudioBlock<float>& block)
+    {
+        const auto numSamples = (int)block.getNumSamples();
+        const auto numOversampled = numSamples * factor;
+        const auto channels = (int)block.getNumChannels();
+        const auto size = baseFftSize * factor;
+
+        for (int done = 0; done < numOversampled;)
+        {
+            const auto length = juce::jmin(numOversampled - done, size - downFill);
+
+            for (int ch = 0; ch < channels; ++ch)
+                std::copy(oversampledBuffer.getReadPointer(ch, done), oversampledBuffer.getReadPointer(ch, done) + length,
+                          downInput.getWritePointer(ch, downFill));
+
+            downFill += length;
+            done += length;
+
+            if (downFill == size)
+            {
+                for (int ch = 0; ch < channels; ++ch)
+                    downsampleHop(ch);
+
+                downAvailable += hopSize;
+                downFill = 2 * halfLength * factor;
+            }
+        }
+
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            auto* fifo = downOutput.getWritePointer(ch);
+            std::copy(fifo, fifo + numSamples, block.getChannelPointer((size_t)ch));
+            std::copy(fifo + numSamples, fifo + downAvailable, fifo);
+        }
+
+        downAvailable -= numSamples;
+    }
+
+    // Fills in bins size/2+1 .. size-1 from their mirror images.
+    static void mirror(float* spectrum, int size)
+    {
+        for (int k = size / 2 + 1; k < size; ++k)
+        {
+            spectrum[2 * k]     =  spectrum[2 * (size - k)];
+            spectrum[2 * k + 1] = -spectrum[2 * (size - k) + 1];
+        }
+    }
+
+   #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+    // Times an up/down round trip through this and the polyphase IIR
+    // oversampler over noise, and logs for both how loud the first image of
+    // a tone at 0.4 times the base rate comes out of upsampling, and the
+    // alias of one at 0.6 times out of downsampling, against the tone.
+    static void runBenchmarks(int stages, int blockSize)
+    {
+        constexpr int numRuns = 64;
+        constexpr int analysisSize = 4096;
+
+        const auto factor = 1 << stages;
+        const auto suffix = "/x" + juce::String(factor);
+
+        FftOversampler fft(1, stages);
+        fft.initProcessing((size_t)blockSize);
+
+        juce::dsp::Oversampling<float> iir(1, (size_t)stages,
+                                           juce::dsp::Oversampling<float>::FilterType::filterHalfBandPolyphaseIIR,
+                                           true);
+        iir.initProcessing((size_t)blockSize);
+
+        juce::AudioBuffer<float> buffer(1, blockSize);
+        juce::Random random(0x5eed);
+
+        auto time = [&](const juce::String& name, auto& oversampler)
+        {
+            auto& section = PerfRegistry::getInstance().getSection("oversampler/" + name + suffix);
+
+            for (int r = 0; r < numRuns; ++r)
+            {
+                for (int n = 0; n < blockSize; ++n)
+                    buffer.getWritePointer(0)[n] = random.nextFloat() * 2.f - 1.f;
+
+                juce::dsp::AudioBlock<float> block(buffer);
+
+                const ScopedPerfMeasurement measurement(&section);
+                oversampler.processSamplesUp(block);
+                oversampler.processSamplesDown(block);
+            }
+        };
+
+        // Level of DFT bin k of the last size samples of signal, against a full-scale sine's.
+        auto binLevelDb = [](const std::vector<float>& signal, int size, int k)
+        {
+            std::complex<double> sum;
+            const auto start = signal.size() - (size_t)size;
+
+            for (int n = 0; n < size; ++n)
+                sum += (double)signal[start + (size_t)n] * std::polar(1.0, -2.0 * juce::MathConstants<double>::pi * k * n / size);
+
+            return 20.0 * std::log10(juce::jmax(1.0e-12, 2.0 * std::abs(sum) / size));
+        };
+
+        // Exact bins, so nothing leaks; three windows' worth covers the latency.
+        const auto toneBin = analysisSize * 2 / 5;
+        const auto imageBin = analysisSize - toneBin;
+        const auto numSamples = analysisSize * 3;
+
+        auto measure = [&](const juce::String& name, auto& oversampler)
+        {
+            oversampler.reset();
+
+            std::vector<float> upsampled, downsampled;
+
+            for (int start = 0; start < numSamples; start += blockSize)
+            {
+                const auto length = juce::jmin(blockSize, numSamples - start);
+
+                for (int n = 0; n < length; ++n)
+                    buffer.getWritePointer(0)[n] = (float)std::sin(2.0 * juce::MathConstants<double>::pi * toneBin * (start + n) / analysisSize);
+
+                juce::dsp::AudioBlock<float> block(buffer);
+                block = block.getSubBlock(0, (size_t)length);
+
+                auto oversampled = oversampler.processSamplesUp(block);
+                auto* data = oversampled.getChannelPointer(0);
+                upsampled.insert(upsampled.end(), data, data + length * factor);
+
+                // Replace the upsampled tone by one above the base band.
+                for (int n = 0; n < length * factor; ++n)
+                    data[n] = (float)std::sin(2.0 * juce::MathConstants<double>::pi * imageBin * (start * factor + n) / (analysisSize * factor));
+
+                oversampler.processSamplesDown(block);
+                downsampled.insert(downsampled.end(), block.getChannelPointer(0), block.getChannelPointer(0) + length);
+            }
+
+            auto image = binLevelDb(upsampled, analysisSize * factor, imageBin) - binLevelDb(upsampled, analysisSize * factor, toneBin);
+            auto alias = binLevelDb(downsampled, analysisSize, toneBin);
+
+            juce::Logger::writeToLog("oversampler/" + name + suffix + ": image " + juce::String(image, 1)
+                                     + " dB, alias " + juce::String(alias, 1) + " dB, latency "
+                                     + juce::String(oversampler.getLatencyInSamples(), 1) + " samples");
+        };
+
+        time("fft", fft);
+        time("iir", iir);
+
+        measure("fft", fft);
+        measure("iir", iir);
+    }
+   #endif
+
+private:
+    using Complex = std::complex<float>;
+
+    static double besselI0(double x)
+    {
+        double sum = 1.0, term = 1.0;
+
+        for (int k = 1; k < 50 && term > 1.0e-12 * sum; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    // Bin k of the real spectrum stored as bins 0..size/2.
+    static Complex getBin(const float* spectrum, int k, int size)
+    {
+        return k <= size / 2 ? Complex(spectrum[2 * k], spectrum[2 * k + 1])
+                             : std::conj(Complex(spectrum[2 * (size - k)], spectrum[2 * (size - k) + 1]));
+    }
+
+    void upsampleHop(int channel)
+    {
+        const auto size = baseFftSize * factor;
+        auto* input = upInput.getWritePointer(channel);
+
+        std::copy(input, input + baseFftSize, baseWork.begin());
+        baseFft.performRealOnlyForwardTransform(baseWork.data(), true);
+
+        // Zero-stuffing repeats the spectrum; the filter keeps the first copy.
+        for (int k = 0; k <= size / 2; ++k)
+        {
+            auto y = getBin(baseWork.data(), k % baseFftSize, baseFftSize) * filter[(size_t)k] * (float)factor;
+            oversampledWork[(size_t)(2 * k)]     = y.real();
+            oversampledWork[(size_t)(2 * k + 1)] = y.imag();
+        }
+
+        mirror(oversampledWork.data(), size);
+        oversampledFft.performRealOnlyInverseTransform(oversampledWork.data());
+
+        // The first 2 * halfLength base samples' worth is wrapped around.
+        auto* fifo = upOutput.getWritePointer(channel, upAvailable);
+        std::copy(oversampledWork.begin() + 2 * halfLength * factor, oversampledWork.begin() + size, fifo);
+
+        std::copy(input + hopSize, input + baseFftSize, input);
+    }
+
+    void downsampleHop(int channel)
+    {
+        const auto size = baseFftSize * factor;
+        auto* input = downInput.getWritePointer(channel);
+
+        std::copy(input, input + size, oversampledWork.begin());
+        oversampledFft.performRealOnlyForwardTransform(oversampledWork.data(), true);
+
+        // Keeping every factor-th sample folds the spectrum onto the base band.
+        for (int k = 0; k <= baseFftSize / 2; ++k)
+        {
+            Complex sum;
+
+            for (int copy = 0; copy < factor; ++copy)
+            {
+                auto bin = k + copy * baseFftSize;
+                auto y = getBin(oversampledWork.data(), bin, size);
+                sum += y * (bin <= size / 2 ? filter[(size_t)bin] : std::conj(filter[(size_t)(size - bin)]));
+            }
+
+            sum /= (float)factor;
+            baseWork[(size_t)(2 * k)]     = sum.real();
+            baseWork[(size_t)(2 * k + 1)] = sum.imag();
+        }
+
+        mirror(baseWork.data(), baseFftSize);
+        baseFft.performRealOnlyInverseTransform(baseWork.data());
+
+        auto* fifo = downOutput.getWritePointer(channel, downAvailable);
+        std::copy(baseWork.begin() + 2 * halfLength, baseWork.begin() + baseFftSize, fifo);
+
+        std::copy(input + hopSize * factor, input + size, input);
+    }
+
+    const int numChannels;
+    const int factor;
+
+    juce::dsp::FFT baseFft, oversampledFft;
+    std::vector<Complex> filter;
+    std::vector<float> baseWork, oversampledWork;
+
+    // Input segments hold the overlap in front of the new samples; the output
+    // FIFOs hold converted samples not handed out yet.
+    juce::AudioBuffer<float> upInput, upOutput, downInput, downOutput;
+    juce::AudioBuffer<float> oversampledBuffer;
+    int upFill{ 0 }, upAvailable{ 0 }, downFill{ 0 }, downAvailable{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(FftOversampler)
+};
@@ -0,0 +1,568 @@
+/*
+  ==============================================================================
+
+    Freeze mode: a fitted Wiener-Hammerstein model of the chain at settled
+    parameters, and the FreezeFitter that builds and checks one on the
+    shared WorkerPool.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+#include <complex>
+#include <vector>
+
+#include "DistortionProcessor.h"
+#include "WorkerPool.h"
+
+
+// Wiener-Hammerstein model of the chain frozen at one gain, tone and volume:
+// linear sections for everything before the clipping curve (BJT stage,
+// op-amp network), the curve as a table, and linear sections for everything
+// after it (RC stage, tone mix, volume). Each side is one biquad fitted to
+// its response across the audio band where that comes close enough, and
+// otherwise its two stages collapsed into two exact biquads. Either way the
+// model runs at most four biquads and a table lookup per sample where the
+// chain runs five filters, a tanh and an atan. Each channel runs its own
+// copy, for the filter state.
+struct FreezeModel
+{
+    // Past this the curve is within 1e-4 of its limits.
+    static constexpr float tableRange = 16.f;
+    static constexpr int tableSize = 2048;
+
+    static inline const std::array<float, tableSize + 1> table = []
+    {
+        std::array<float, tableSize + 1> t{};
+
+        for (int i = 0; i <= tableSize; ++i)
+        {
+            auto y = tableRange * (2.f * (float)i / (float)tableSize - 1.f);
+            t[(size_t)i] = DistortionProcessor::clipDiodes(DistortionProcessor::saturateOpAmp(y));
+        }
+
+        return t;
+    }();
+
+    // Largest error relative to the exact response, anywhere from 20 Hz to
+    // the band limit, at which one fitted biquad replaces a side's two:
+    // within about 0.4 dB. The pre side gets there up to mid gain.
+    static constexpr double maxFitError = 0.05;
+
+    // Models the chain for newParams at the oversampled rate newSampleRate.
+    void fit(const DistortionParameters& newParams, double newSampleRate, double bandLimit)
+    {
+        params = newParams;
+        sampleRate = newSampleRate;
+
+        AnalogParameters bjtP, rcP, toneLpP, toneHpP;
+        DistortionProcessor::getConstFilterParameters(bjtP, rcP, toneLpP, toneHpP);
+
+        bjtP.A *= DistortionProcessor::bjtGain;
+        bjtP.B *= DistortionProcessor::bjtGain;
+        bjtP.C *= DistortionProcessor::bjtGain;
+
+        // OpAmpFilter's network as a plain transfer function.
+        const auto halfT = 0.5 / sampleRate;
+        const auto opamp = OpAmpFilter::computeCoefficients(params.gain, halfT);
+        const auto w0 = (double)opamp.g / halfT;
+
+        AnalogParameters opampP;
+        opampP.A = 1.0 / (w0 * w0);
+        opampP.B = ((double)opamp.k + (double)opamp.m) / w0;
+        opampP.C = 1.0;
+        opampP.D = 1.0 / (w0 * w0);
+        opampP.E = (double)opamp.k / w0;
+        opampP.F = 1.0;
+
+        const auto toneP = mixFirstOrder(toneLpP, (1.0 - (double)params.tone) * (double)params.volume,
+                                         toneHpP, (double)params.tone * (double)params.volume);
+
+        // Normalised to the middle of the band, which keeps the fit well conditioned.
+        const auto reference = 2.0 * juce::MathConstants<double>::pi * std::sqrt(lowestFrequency * bandLimit);
+
+        Grid grid;
+
+        for (int i = 0; i < numFitPoints; ++i)
+        {
+            auto f = lowestFrequency * std::pow(bandLimit / lowestFrequency, (double)i / (numFitPoints - 1));
+
+            // The analog frequency that the bilinear transform puts at f.
+            grid.omegas.push_back(2.0 * sampleRate * std::tan(juce::MathConstants<double>::pi * f / sampleRate));
+        }
+
+        grid.reference = reference;
+
+        numPre  = fitSide(grid, bjtP, opampP, pre);
+        numPost = fitSide(grid, rcP,  toneP,  post);
+
+        reset();
+    }
+
+    bool matches(const DistortionParameters& other) const
+    {
+        return serial != 0
+            && other.gain   == params.gain
+            && other.tone   == params.tone
+            && other.volume == params.volume;
+    }
+
+    // Biquads per sample, 2 to 4.
+    int getNumSections() const { return numPre + numPost; }
+
+    void reset()
+    {
+        for (auto& section : pre)
+            section.reset();
+
+        for (auto& section : post)
+            section.reset();
+    }
+
+    void processBlock(float* data, int numSamples)
+    {
+        for (int i = 0; i < numPre; ++i)
+            pre[(size_t)i].processBlock(data, numSamples);
+
+        // A non-finite input would otherwise stay in the filter state for good.
+        if (!DistortionProcessor::allFinite(data, numSamples))
+        {
+            reset();
+            std::fill(data, data + numSamples, 0.f);
+            return;
+        }
+
+        for (int n = 0; n < numSamples; ++n)
+            data[n] = shape(data[n]);
+
+        for (int i = 0; i < numPost; ++i)
+            post[(size_t)i].processBlock(data, numSamples);
+    }
+
+    // Linear interpolation between entries is within 1e-4 of the curve.
+    static float shape(float y)
+    {
+        constexpr float scale = (float)tableSize / (2.f * tableRange);
+
+        auto position = juce::jmin((float)tableSize, juce::jmax(0.f, (y + tableRange) * scale));
+        auto index = juce::jmin((int)position, tableSize - 1);
+        auto fraction = position - (float)index;
+
+        return table[(size_t)index] + fraction * (table[(size_t)index + 1] - table[(size_t)index]);
+    }
+
+    // What the model was fitted for; serial 0 means no model.
+    DistortionParameters params;
+    double sampleRate{ 0.0 };
+    uint32_t serial{ 0 };
+
+private:
+    using Response = std::vector<std::complex<double>>;
+
+    static constexpr int numFitPoints = 128;
+    static constexpr double lowestFrequency = 20.0;
+
+    struct Grid
+    {
+        std::vector<double> omegas;
+        double reference{ 1.0 };
+    };
+
+    // Fills in one or two sections for the cascade first * second and
+    // returns how many it used.
+    int fitSide(const Grid& grid, const AnalogParameters& first, const AnalogParameters& second,
+                std::array<Biquad, 2>& sections) const
+    {
+        std::vector<double> normalised;
+        Response response;
+
+        for (auto omega : grid.omegas)
+        {
+            const std::complex<double> s(0.0, omega);
+
+            normalised.push_back(omega / grid.reference);
+            response.push_back(evaluate(first, s) * evaluate(second, s));
+        }
+
+        AnalogParameters fitted;
+
+        if (fitAnalog(normalised, response, fitted))
+        {
+            const auto r = grid.reference;
+
+            fitted.A /= r * r;
+            fitted.B /= r;
+            fitted.D /= r * r;
+            fitted.E /= r;
+
+            double maxError = 0.0;
+
+            for (size_t k = 0; k < grid.omegas.size(); ++k)
+                maxError = juce::jmax(maxError, std::abs(evaluate(fitted, { 0.0, grid.omegas[k] }) / response[k] - 1.0));
+
+            if (maxError <= maxFitError)
+            {
+                calculateCoefficients(sections[0], fitted, (float)sampleRate);
+                return 1;
+            }
+        }
+
+        calculateCoefficients(sections[0], first,  (float)sampleRate);
+        calculateCoefficients(sections[1], second, (float)sampleRate);
+
+        return 2;
+    }
+
+    // wx * x + wy * y for first-order sections (A = D = 0), as one second-order one.
+    static AnalogParameters mixFirstOrder(const AnalogParameters& x, double wx, const AnalogParameters& y, double wy)
+    {
+        AnalogParameters p;
+
+        p.A = wx * x.B * y.E + wy * y.B * x.E;
+        p.B = wx * (x.B * y.F + x.C * y.E) + wy * (y.B * x.F + y.C * x.E);
+        p.C = wx * x.C * y.F + wy * y.C * x.F;
+
+        p.D = x.E * y.E;
+        p.E = x.E * y.F + x.F * y.E;
+        p.F = x.F * y.F;
+
+        return p;
+    }
+
+    static std::complex<double> evaluate(const AnalogParameters& p, std::complex<double> s)
+    {
+        return (p.A * s * s + p.B * s + p.C) / (p.D * s * s + p.E * s + p.F);
+    }
+
+    // (A s^2 + B s + C) / (D s^2 + E s + 1) through response: Levy's
+    // linearised least squares, reweighted by the previous denominator
+    // (Sanathanan-Koerner) until it minimises the actual error, relative to
+    // |response| so quiet and loud parts of the band count alike.
+    static bool fitAnalog(const std::vector<double>& omegas, const Response& response, AnalogParameters& p)
+    {
+        constexpr int numIterations = 5;
+        constexpr int numUnknowns = 5;
+
+        double u[numUnknowns]{};
+
+        for (int iteration = 0; iteration < numIterations; ++iteration)
+        {
+            double m[numUnknowns][numUnknowns]{};
+            double v[numUnknowns]{};
+
+            for (size_t k = 0; k < omegas.size(); ++k)
+            {
+                const std::complex<double> s(0.0, omegas[k]);
+                const auto h = response[k];
+
+                auto weight = 1.0 / std::abs(h);
+
+                if (iteration > 0)
+                    weight /= std::abs(u[3] * s * s + u[4] * s + 1.0);
+
+                // N(s) - h (D s^2 + E s) = h
+                const std::complex<double> row[numUnknowns] = { s * s, s, 1.0, -h * s * s, -h * s };
+
+                for (auto part : { 0, 1 })
+                {
+                    double r[numUnknowns];
+
+                    for (int j = 0; j < numUnknowns; ++j)
+                        r[j] = weight * (part == 0 ? row[j].real() : row[j].imag());
+
+                    const auto rhs = weight * (part == 0 ? h.real() : h.imag());
+
+                    for (int i = 0; i < numUnknowns; ++i)
+                    {
+                        for (int j = 0; j < numUnknowns; ++j)
+                            m[i][j] += r[i] * r[j];
+
+                        v[i] += r[i] * rhs;
+                    }
+                }
+            }
+
+            if (!solve(m, v, u))
+                return false;
+        }
+
+        p = { u[0], u[1], u[2], u[3], u[4], 1.0 };
+
+        // Both denominator coefficients positive: the poles are in the left half-plane.
+        return std::isfinite(u[0] + u[1] + u[2] + u[3] + u[4]) && u[3] > 0.0 && u[4] > 0.0;
+    }
+
+    // Gaussian elimination with partial pivoting on the normal equations,
+    // scaled to a unit diagonal first: the columns differ by orders of magnitude.
+    template <int N>
+    static bool solve(double (&m)[N][N], double (&v)[N], double (&u)[N])
+    {
+        double scale[N];
+
+        for (int i = 0; i < N; ++i)
+        {
+            if (!(m[i][i] > 0.0))
+                return false;
+
+            scale[i] = 1.0 / std::sqrt(m[i][i]);
+        }
+
+        for (int i = 0; i < N; ++i)
+        {
+            for (int j = 0; j < N; ++j)
+                m[i][j] *= scale[i] * scale[j];
+
+            v[i] *= scale[i];
+        }
+
+        for (int col = 0; col < N; ++col)
+        {
+            int pivot = col;
+
+            for (int row = col + 1; row < N; ++row)
+                if (std::abs(m[row][col]) > std::abs(m[pivot][col]))
+                    pivot = row;
+
+            if (std::abs(m[pivot][col]) < 1.0e-300)
+                return false;
+
+            std::swap(m[col], m[pivot]);
+            std::swap(v[col], v[pivot]);
+
+            for (int row = col + 1; row < N; ++row)
+            {
+                auto factor = m[row][col] / m[col][col];
+
+                for (int j = col; j < N; ++j)
+                    m[row][j] -= factor * m[col][j];
+
+                v[row] -= factor * v[col];
+            }
+        }
+
+        double x[N];
+
+        for (int row = N - 1; row >= 0; --row)
+        {
+            auto sum = v[row];
+
+            for (int j = row + 1; j < N; ++j)
+                sum -= m[row][j] * x[j];
+
+            x[row] = sum / m[row][row];
+        }
+
+        for (int i = 0; i < N; ++i)
+            u[i] = x[i] * scale[i];
+
+        return true;
+    }
+
+    std::array<Biquad, 2> pre, post;
+    int numPre{ 0 }, numPost{ 0 };
+};
+
+// Fits FreezeModels on the shared WorkerPool for Freeze mode. Once gain,
+// tone and volume have stayed put for settleSeconds, update() queues a fit
+// for them. The worker then runs the model and a DistortionProcessor over a
+// test signal for its error and CPU saving, and publishes it if the error is
+// within maxErrorDb. That signal is a single synthetic pluck, see measure(),
+// so the threshold says nothing about other material. The audio thread
+// copies models out under a try-lock, so it never waits.
+class FreezeFitter
+{
+public:
+    static constexpr double settleSeconds = 0.25;
+    static constexpr float maxErrorDb = -30.f;
+
+    // How the latest fit did, whether it was published or not.
+    struct Report
+    {
+        // Output error relative to the chain's output level.
+        float errorDb{ 0.f };
+
+        // Share of the chain's time the model saves, excluding the oversampler.
+        float cpuSaving{ 0.f };
+
+        int numSections{ 0 };
+        bool published{ false };
+    };
+
+    FreezeFitter() = default;
+
+    ~FreezeFitter()
+    {
+        pool->removeJob(fitJob);
+    }
+
+    // Audio thread, once per block while Freeze mode is on.
+    void update(const DistortionParameters& params, double sampleRate, int oversamplingFactor, int numSamples)
+    {
+        const auto oversampledRate = sampleRate * (double)oversamplingFactor;
+
+        // Modulated parameters never settle.
+        const bool modulated = params.envelope > 0.f || params.lfoGain > 0.f || params.lfoTone > 0.f || params.sidechain > 0.f;
+
+        if (modulated || params.gain != watched.gain || params.tone != watched.tone || params.volume != watched.volume
+            || oversampledRate != watchedRate)
+        {
+            watched = params;
+            watchedRate = oversampledRate;
+            settledSamples = 0;
+            requested = false;
+            return;
+        }
+
+        if (requested)
+            return;
+
+        settledSamples += numSamples;
+
+        if ((double)settledSamples < settleSeconds * sampleRate)
+            return;
+
+        requestedGain.store(params.gain);
+        requestedTone.store(params.tone);
+        requestedVolume.store(params.volume);
+        requestedRate.store(oversampledRate);
+        requestedBandLimit.store(juce::jmin(20000.0, 0.45 * sampleRate));
+        requestPending.store(true, std::memory_order_release);
+
+        requested = pool->addJob(fitJob, WorkerPool::low);
+    }
+
+    // Audio thread. Copies the latest published model into model unless it
+    // holds that one already or the worker is publishing right now.
+    bool takeFitted(FreezeModel& model)
+    {
+        const juce::SpinLock::ScopedTryLockType lock(fittedLock);
+
+        if (!lock.isLocked() || fitted.serial == model.serial)
+            return false;
+
+        model = fitted;
+        return true;
+    }
+
+    Report getReport() const
+    {
+        const juce::SpinLock::ScopedLockType lock(fittedLock);
+        return report;
+    }
+
+private:
+    static constexpr double testSeconds = 0.1;
+
+    // On a worker.
+    void fit()
+    {
+        if (!requestPending.exchange(false, std::memory_order_acquire))
+            return;
+
+        DistortionParameters params;
+        params.gain   = requestedGain.load();
+        params.tone   = requestedTone.load();
+        params.volume = requestedVolume.load();
+
+        FreezeModel model;
+        model.fit(params, requestedRate.load(), requestedBandLimit.load());
+
+        const auto result = measure(model);
+
+        {
+            const juce::SpinLock::ScopedLockType lock(fittedLock);
+
+            report = result;
+
+            if (result.published)
+            {
+                model.serial = ++lastSerial;
+                fitted = model;
+            }
+        }
+
+       #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+        juce::Logger::writeToLog("freeze: " + juce::String(result.numSections) + " biquads, error "
+                                 + juce::String(result.errorDb, 1) + " dB, "
+                                 + juce::String(100.f * result.cpuSaving, 0) + "% less CPU"
+                                 + (result.published ? "" : ", not used"));
+       #endif
+    }
+
+    // Runs both on a plucked A string: eight harmonics of 110 Hz, decaying,
+    // peaking around 0.3.
+    static Report measure(const FreezeModel& model)
+    {
+        const auto numSamples = (int)(model.sampleRate * testSeconds);
+
+        std::vector<float> expected((size_t)numSamples);
+
+        for (int n = 0; n < numSamples; ++n)
+        {
+            auto t = (double)n / model.sampleRate;
+            double x = 0.0;
+
+            for (int harmonic = 1; harmonic <= 8; ++harmonic)
+                x += std::sin(2.0 * juce::MathConstants<double>::pi * 110.0 * harmonic * t) / harmonic;
+
+            expected[(size_t)n] = (float)(0.11 * std::exp(-3.0 * t) * x);
+        }
+
+        auto actual = expected;
+        auto frozen = model;
+
+        DistortionProcessor reference;
+        reference.setParameters(model.params);
+        reference.prepare(model.sampleRate);
+
+        float* channel = expected.data();
+        juce::dsp::AudioBlock<float> block(&channel, 1, (size_t)numSamples);
+
+        const auto start = juce::Time::getHighResolutionTicks();
+        reference.processBlock(block);
+        const auto referenceDone = juce::Time::getHighResolutionTicks();
+        frozen.processBlock(actual.data(), numSamples);
+        const auto frozenDone = juce::Time::getHighResolutionTicks();
+
+        double error = 0.0, level = 0.0;
+
+        for (int n = 0; n < numSamples; ++n)
+        {
+            auto difference = (double)actual[(size_t)n] - (double)expected[(size_t)n];
+            error += difference * difference;
+            level += (double)expected[(size_t)n] * (double)expected[(size_t)n];
+        }
+
+        Report result;
+        result.errorDb = level > 0.0 ? (float)(10.0 * std::log10(juce::jmax(error / level, 1.0e-20))) : 0.f;
+        result.cpuSaving = 1.f - (float)(frozenDone - referenceDone) / (float)juce::jmax((juce::int64)1, referenceDone - start);
+        result.numSections = model.getNumSections();
+        result.published = level > 0.0 && result.errorDb <= maxErrorDb;
+
+        return result;
+    }
+
+    juce::SharedResourcePointer<WorkerPool> pool;
+    WorkerPool::Job fitJob{ [this] { fit(); } };
+
+    // Audio thread only.
+    DistortionParameters watched;
+    double watchedRate{ 0.0 };
+    int settledSamples{ 0 };
+    bool requested{ false };
+
+    std::atomic<bool> requestPending{ false };
+    std::atomic<float> requestedGain{ 0.f }, requestedTone{ 0.f }, requestedVolume{ 0.f };
+    std::atomic<double> requestedRate{ 0.0 }, requestedBandLimit{ 0.0 };
+
+    mutable juce::SpinLock fittedLock;
+    FreezeModel fitted;
+    Report report;
+    uint32_t lastSerial{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(FreezeFitter)
+};
@@ -0,0 +1,383 @@
+/*
+  ==============================================================================
+
+    Batching across plugin instances: instances that opt in share the SIMD
+    lanes of one LaneEngine, a round of oversampled samples at a time.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <array>
+#include <memory>
+
+#include "EngineSet.h"
+#include "LaneEngine.h"
+
+
+// Process-wide, through juce::SharedResourcePointer: instances that opt in
+// put their oversampled rounds into lanes of one LaneEngine, and the member
+// whose submission completes a round processes everybody's. Each member
+// collects its output when it comes back for the next round.
+//
+// Rounds only line up when the host calls the members one after another on
+// one thread. A member whose last round is still queued when it comes to
+// collect, because someone skipped a block, processes the queue itself.
+// Calls that find the lock taken, because another thread is in here, fail
+// at once; the caller runs that round on its own and stays a member.
+class InstanceBatcher
+{
+public:
+    static constexpr int maxLanes = LaneEngine::maxLanes;
+
+    // Returns the first of numLanes lanes, or -1 if they do not fit or the
+    // rate and round size differ from those of the current members.
+    int join(int numLanes, double oversampledRate, int roundSize)
+    {
+        const juce::SpinLock::ScopedLockType lock(mutex);
+
+        if (getNumUsedLanes() == 0)
+        {
+            sampleRate = oversampledRate;
+            numRoundSamples = roundSize;
+
+            lanes.prepare(sampleRate, 1);
+            laneBuffer.setSize(maxLanes, numRoundSamples);
+            idleBuffer.setSize(maxLanes, numRoundSamples);
+            laneBuffer.clear();
+
+            queued.fill(false);
+            numSubmitted = 0;
+        }
+        else if (oversampledRate != sampleRate || roundSize != numRoundSamples)
+        {
+            return -1;
+        }
+
+        for (int first = 0; first + numLanes <= maxLanes; ++first)
+        {
+            if (std::any_of(used.begin() + first, used.begin() + first + numLanes, [](bool u) { return u; }))
+                continue;
+
+            for (int lane = first; lane < first + numLanes; ++lane)
+            {
+                used[(size_t)lane] = true;
+                lanes.resetLane(lane);
+                laneBuffer.clear(lane, 0, numRoundSamples);
+            }
+
+            lanes.setNumChannels(getNumUsedLanes());
+            ++numMembers;
+
+            return first;
+        }
+
+        return -1;
+    }
+
+    void leave(int firstLane, int numLanes)
+    {
+        const juce::SpinLock::ScopedLockType lock(mutex);
+
+        if (queued[(size_t)firstLane])
+            --numSubmitted;
+
+        for (int lane = firstLane; lane < firstLane + numLanes; ++lane)
+            used[(size_t)lane] = queued[(size_t)lane] = false;
+
+        --numMembers;
+
+        lanes.setNumChannels(juce::jmax(1, getNumUsedLanes()));
+
+        // The next member to join sets them up again.
+        if (getNumUsedLanes() == 0)
+        {
+            laneBuffer.setSize(0, 0);
+            idleBuffer.setSize(0, 0);
+        }
+    }
+
+    // Audio thread. Queues block, one channel per lane, for the current round.
+    // Like collect(), it only tries the lock once and fails if another member
+    // holds it, so no audio thread ever waits for another. A member that ran
+    // its last round on its own passes those lanes in resumeFrom, whose filter
+    // state its lanes here then take over.
+    bool submit(int firstLane, const juce::dsp::AudioBlock<float>& block, const DistortionParameters& params,
+                const LaneEngine* resumeFrom = nullptr)
+    {
+        const juce::SpinLock::ScopedTryLockType lock(mutex);
+
+        if (!lock.isLocked())
+            return false;
+
+        jassert((int)block.getNumSamples() == numRoundSamples);
+
+        if (queued[(size_t)firstLane])
+            processRound();
+
+        for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
+        {
+            const auto lane = firstLane + (int)ch;
+
+            laneBuffer.copyFrom(lane, 0, block.getChannelPointer(ch), numRoundSamples);
+            lanes.setParameters(lane, params);
+            queued[(size_t)lane] = true;
+
+            if (resumeFrom != nullptr)
+                lanes.setLaneState(lane, resumeFrom->getLaneState((int)ch));
+        }
+
+        if (++numSubmitted >= numMembers)
+            processRound();
+
+        return true;
+    }
+
+    // Audio thread. Copies the output of the member's last submit into block,
+    // and the filter state of its lanes into stateOut, for a round it may
+    // have to run on its own.
+    bool collect(int firstLane, juce::dsp::AudioBlock<float>& block, LaneEngine& stateOut)
+    {
+        const juce::SpinLock::ScopedTryLockType lock(mutex);
+
+        if (!lock.isLocked())
+            return false;
+
+        if (queued[(size_t)firstLane])
+            processRound();
+
+        for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
+        {
+            juce::FloatVectorOperations::copy(block.getChannelPointer(ch),
+                                              laneBuffer.getReadPointer(firstLane + (int)ch),
+                                              numRoundSamples);
+
+            stateOut.setLaneState((int)ch, lanes.getLaneState(firstLane + (int)ch));
+        }
+
+        return true;
+    }
+
+private:
+    int getNumUsedLanes() const
+    {
+        for (int lane = maxLanes; lane > 0; --lane)
+            if (used[(size_t)lane - 1])
+                return lane;
+
+        return 0;
+    }
+
+    // Lanes with nothing queued run on silence, so the output waiting in
+    // laneBuffer for their members stays untouched, and get their filter
+    // state back afterwards, as if the round had not happened for them.
+    void processRound()
+    {
+        const auto numLanes = getNumUsedLanes();
+        float* channels[maxLanes];
+        LaneEngine::LaneState idleStates[maxLanes];
+
+        idleBuffer.clear();
+
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            if (queued[(size_t)lane])
+            {
+                channels[lane] = laneBuffer.getWritePointer(lane);
+            }
+            else
+            {
+                channels[lane] = idleBuffer.getWritePointer(lane);
+                idleStates[lane] = lanes.getLaneState(lane);
+            }
+        }
+
+        lanes.process(channels, numLanes, numRoundSamples);
+
+        for (int lane = 0; lane < numLanes; ++lane)
+            if (!queued[(size_t)lane])
+                lanes.setLaneState(lane, idleStates[lane]);
+
+        queued.fill(false);
+        numSubmitted = 0;
+    }
+
+    juce::SpinLock mutex;
+
+    LaneEngine lanes;
+    juce::AudioBuffer<float> laneBuffer, idleBuffer;
+    double sampleRate{ 0.0 };
+    int numRoundSamples{ 0 };
+
+    std::array<bool, maxLanes> used{}, queued{};
+    int numMembers{ 0 };
+    int numSubmitted{ 0 };
+};
+
+// One instance's side of the InstanceBatcher. It frames the host's blocks
+// into rounds of maxBlockSize samples, oversamples them and hands them over;
+// the output runs one round behind. A round the batcher is too busy for runs
+// on the engine's own lanes, from the filter state its batcher lanes had, so
+// contention neither clicks nor costs the engine its place.
+class BatchedEngine
+{
+public:
+    explicit BatchedEngine(const EngineConfig& config)
+        : numChannels(config.numChannels), roundSize(config.maxBlockSize), oversamplerBytes(config.getOversamplerBytes())
+    {
+        oversampler = std::make_unique<juce::dsp::Oversampling<float>>(
+            (size_t)numChannels,
+            (size_t)config.oversamplingStages,
+            juce::dsp::Oversampling<float>::FilterType::filterHalfBandPolyphaseIIR,
+            true);
+
+        oversampler->initProcessing((size_t)roundSize);
+
+        const auto factor = (int)oversampler->getOversamplingFactor();
+        const auto ovSampleRate = config.sampleRate * (double)factor;
+
+        soloLanes.prepare(ovSampleRate, numChannels);
+        firstLane = batcher->join(numChannels, ovSampleRate, roundSize * factor);
+
+        inputFifo.setSize(numChannels, roundSize);
+        outputFifo.setSize(numChannels, roundSize);
+        inputFifo.clear();
+        outputFifo.clear();
+    }
+
+    ~BatchedEngine()
+    {
+        if (firstLane >= 0)
+            batcher->leave(firstLane, numChannels);
+    }
+
+    // False if the batcher had no room or runs at another rate or round size.
+    bool isBatched() const
+    {
+        return firstLane >= 0;
+    }
+
+    int getLatencyInSamples() const
+    {
+        return roundSize + juce::roundToInt(oversampler->getLatencyInSamples());
+    }
+
+    // The lanes in the batcher are not counted: they stay with it.
+    size_t getAllocatedBytes() const
+    {
+        return oversamplerBytes
+             + 2 * (size_t)numChannels * (size_t)roundSize * sizeof(float);
+    }
+
+    void setParameters(const DistortionParameters& newParams)
+    {
+        params = newParams;
+
+        for (int lane = 0; lane < numChannels; ++lane)
+            soloLanes.setParameters(lane, params);
+    }
+
+    void process(juce::dsp::AudioBlock<float>& block)
+    {
+        const auto numSamples = (int)block.getNumSamples();
+        const auto numBlockChannels = juce::jmin((int)block.getNumChannels(), numChannels);
+
+        for (int start = 0; start < numSamples;)
+        {
+            if (fifoPosition == 0 && awaitingOutput)
+                collectRound();
+
+            const auto length = juce::jmin(numSamples - start, roundSize - fifoPosition);
+
+            for (int ch = 0; ch < numBlockChannels; ++ch)
+            {
+                auto* samples = block.getChannelPointer((size_t)ch) + start;
+
+                inputFifo.copyFrom(ch, fifoPosition, samples, length);
+                juce::FloatVectorOperations::copy(samples, outputFifo.getReadPointer(ch, fifoPosition), length);
+            }
+
+            // Channels the block does not have are silent, not the last block's.
+            for (int ch = numBlockChannels; ch < numChannels; ++ch)
+                inputFifo.clear(ch, fifoPosition, length);
+
+            start += length;
+            fifoPosition += length;
+
+            if (fifoPosition == roundSize)
+            {
+                submitRound();
+                fifoPosition = 0;
+            }
+        }
+    }
+
+private:
+    void submitRound()
+    {
+        juce::dsp::AudioBlock<float> input(inputFifo);
+        oversampledBlock = oversampler->processSamplesUp(input);
+
+        if (batcher->submit(firstLane, oversampledBlock, params, ranSolo ? &soloLanes : nullptr))
+        {
+            awaitingOutput = true;
+            ranSolo = false;
+            return;
+        }
+
+        processSolo();
+    }
+
+    void collectRound()
+    {
+        awaitingOutput = false;
+
+        if (batcher->collect(firstLane, oversampledBlock, soloLanes))
+        {
+            juce::dsp::AudioBlock<float> output(outputFifo);
+            oversampler->processSamplesDown(output);
+            return;
+        }
+
+        // The oversampler still holds the round's input.
+        processSolo();
+    }
+
+    void processSolo()
+    {
+        ranSolo = true;
+
+        float* channels[LaneEngine::maxLanes];
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            channels[ch] = oversampledBlock.getChannelPointer((size_t)ch);
+
+        soloLanes.process(channels, numChannels, (int)oversampledBlock.getNumSamples());
+
+        juce::dsp::AudioBlock<float> output(outputFifo);
+        oversampler->processSamplesDown(output);
+    }
+
+    juce::SharedResourcePointer<InstanceBatcher> batcher;
+
+    const int numChannels;
+    const int roundSize;
+    const size_t oversamplerBytes;
+
+    std::unique_ptr<juce::dsp::Oversampling<float>> oversampler;
+    juce::dsp::AudioBlock<float> oversampledBlock;
+    LaneEngine soloLanes;
+
+    juce::AudioBuffer<float> inputFifo, outputFifo;
+    int fifoPosition{ 0 };
+    bool awaitingOutput{ false };
+
+    DistortionParameters params;
+    int firstLane{ -1 };
+    bool ranSolo{ false };
+
+    JUCE_DECLARE_NON_COPYABLE(BatchedEngine)
+};
@@ -0,0 +1,361 @@
+/*
+  ==============================================================================
+
+    The chain in structure-of-arrays form: one lane per channel, processed
+    side by side so the compiler can vectorize across channels. The
+    multi-bus engine and the instance batcher run on it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "DistortionProcessor.h"
+
+
+// Float versions of the functions in the static nonlinearities that compile
+// to straight-line code, so loops over lanes vectorize. Both stay within
+// 2e-7 of the library functions, which is float rounding.
+namespace LaneMath
+{
+    // The smaller of two non-negative floats, taken on their bit patterns (which
+    // sort the same way) with integer arithmetic only: a float comparison whose
+    // result feeds further arithmetic keeps the loop from being vectorised.
+    inline float minPositive(float x, float limit)
+    {
+        int32_t xBits, limitBits;
+        std::memcpy(&xBits, &x, sizeof(x));
+        std::memcpy(&limitBits, &limit, sizeof(limit));
+
+        int32_t difference = xBits - limitBits;
+        xBits = limitBits + (difference & (difference >> 31));
+        std::memcpy(&x, &xBits, sizeof(x));
+        return x;
+    }
+
+    // 1 if x > edge, 0 otherwise, for non-negative floats; see minPositive.
+    inline float stepPositive(float x, float edge)
+    {
+        uint32_t xBits, edgeBits;
+        std::memcpy(&xBits, &x, sizeof(x));
+        std::memcpy(&edgeBits, &edge, sizeof(edge));
+
+        return (float)((edgeBits - xBits) >> 31);
+    }
+
+    // e^x for |x| < 87, unchecked: x = n ln2 + r with |r| <= ln2 / 2, Taylor polynomial for e^r.
+    inline float exp(float x)
+    {
+        // Round to nearest without a library call.
+        float n = (x * 1.44269504f + 12582912.f) - 12582912.f;
+        float r = x - n * 0.693359375f + n * 2.12194440e-4f;
+
+        float p = 1.f + r * (1.f + r * (0.5f + r * (1.66666667e-1f + r * (4.16666667e-2f
+                      + r * (8.33333333e-3f + r * 1.38888889e-3f)))));
+
+        int32_t bits = ((int32_t)n + 127) << 23;
+        float scale;
+        std::memcpy(&scale, &bits, sizeof(scale));
+
+        return p * scale;
+    }
+
+    inline float tanh(float x)
+    {
+        // tanh(9) rounds to 1.
+        float t = 1.f - 2.f / (LaneMath::exp(2.f * minPositive(std::abs(x), 9.f)) + 1.f);
+        return std::copysign(t, x);
+    }
+
+    // Cephes' atanf. Both argument reductions are always computed and then
+    // blended with 0/1 masks: compilers keep selects between computed values
+    // scalar unless floating-point traps are switched off.
+    inline float atan(float x)
+    {
+        float a = std::abs(x);
+        float inverse = -1.f / (a + 1.0e-30f);
+        float shifted = (a - 1.f) / (a + 1.f);
+
+        float big = stepPositive(a, 2.41421356f);
+        float mid = stepPositive(a, 0.41421356f);
+
+        float t = mid * shifted + (1.f - mid) * a;
+        t = big * inverse + (1.f - big) * t;
+        float base = 0.78539816f * (mid + big);
+
+        float z = t * t;
+        float y = base + ((((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z
+                           - 3.33329491539e-1f) * z * t + t);
+
+        return std::copysign(y, x);
+    }
+}
+
+// Fixed-coefficient biquad for LaneEngine: one set of coefficients, separate
+// DF1 state per lane.
+template <typename T>
+struct LaneBiquad
+{
+    static constexpr int maxLanes = 16;
+
+    void setCoefficients(double B0, double B1, double B2, double A1, double A2)
+    {
+        b0 = (T)B0; b1 = (T)B1; b2 = (T)B2;
+                    a1 = (T)A1; a2 = (T)A2;
+    }
+
+    // x holds one sample for each of the first numLanes lanes.
+    template <int numLanes>
+    void process(float* x)
+    {
+        for (int l = 0; l < numLanes; ++l)
+        {
+            T in = (T)x[l];
+            T y  = in * b0 + x1[l] * b1 + x2[l] * b2;
+              y -= y1[l] * a1 + y2[l] * a2;
+
+            x2[l] = x1[l];
+            x1[l] = in;
+
+            y2[l] = y1[l];
+            y1[l] = y;
+
+            x[l] = (float)y;
+        }
+    }
+
+    void resetLane(int lane)
+    {
+        x1[(size_t)lane] = x2[(size_t)lane] = T(0);
+        y1[(size_t)lane] = y2[(size_t)lane] = T(0);
+    }
+
+    struct State { T x1, x2, y1, y2; };
+
+    State getState(int lane) const
+    {
+        const auto i = (size_t)lane;
+        return { x1[i], x2[i], y1[i], y2[i] };
+    }
+
+    void setState(int lane, const State& state)
+    {
+        const auto i = (size_t)lane;
+        x1[i] = state.x1; x2[i] = state.x2;
+        y1[i] = state.y1; y2[i] = state.y2;
+    }
+
+    T b0{}, b1{}, b2{};
+    T       a1{}, a2{};
+
+    std::array<T, maxLanes> x1{}, x2{}, y1{}, y2{};
+};
+
+// DistortionProcessor's chain for several channels side by side, one channel
+// per lane, for multi-bus instances. State and per-lane coefficients are
+// arrays over lanes (structure of arrays). The chain runs one frame (a sample
+// of every lane) at a time, with each stage a loop over a fixed number of
+// lanes, a multiple of laneGroup, so the compiler turns the lanes into SIMD
+// vectors. Gain, tone and volume are per lane; envelope, LFO and sidechain
+// modulation are not available here.
+struct LaneEngine
+{
+    static constexpr int maxLanes  = LaneBiquad<float>::maxLanes;
+    static constexpr int laneGroup = 4;
+    static constexpr int chunkSize = 64;
+
+    void prepare(double sampleRate, int numChannels)
+    {
+        setNumChannels(numChannels);
+        halfT = 0.5 / sampleRate;
+
+        AnalogParameters bjtParams, rcParams, toneLpParams, toneHpParams;
+        DistortionProcessor::getConstFilterParameters(bjtParams, rcParams, toneLpParams, toneHpParams);
+
+        calculateCoefficients(bjt,    bjtParams,    (float)sampleRate);
+        calculateCoefficients(rc,     rcParams,     (float)sampleRate);
+        calculateCoefficients(toneLP, toneLpParams, (float)sampleRate);
+        calculateCoefficients(toneHP, toneHpParams, (float)sampleRate);
+
+        for (int lane = 0; lane < maxLanes; ++lane)
+        {
+            gains[(size_t)lane] = -1.f;
+            setParameters(lane, {});
+            resetLane(lane);
+        }
+
+        for (auto& frame : frames)
+            std::fill(std::begin(frame), std::end(frame), 0.f);
+    }
+
+    // Lanes from numChannels on are left alone, apart from the rest of their group.
+    void setNumChannels(int numChannels)
+    {
+        jassert(numChannels > 0 && numChannels <= maxLanes);
+
+        numGroups = (numChannels + laneGroup - 1) / laneGroup;
+    }
+
+    void setParameters(int lane, const DistortionParameters& params)
+    {
+        const auto i = (size_t)lane;
+
+        if (!juce::approximatelyEqual(params.gain, gains[i]))
+        {
+            gains[i] = params.gain;
+
+            auto c = OpAmpFilter::computeCoefficients(params.gain, halfT);
+            g[i] = c.g;
+            k[i] = c.k;
+            m[i] = c.m;
+            d[i] = 1.f / (1.f + c.g * (c.k + c.g));
+        }
+
+        tone[i]   = params.tone;
+        volume[i] = params.volume;
+    }
+
+    // channels[lane] for every lane below numChannels, processed in place.
+    void process(float* const* channels, int numChannels, int numSamples)
+    {
+        jassert(numChannels <= numGroups * laneGroup);
+
+        for (int start = 0; start < numSamples; start += chunkSize)
+        {
+            const auto length = juce::jmin(chunkSize, numSamples - start);
+
+            // Interleave, so that a frame holds one sample of every lane.
+            for (int lane = 0; lane < numChannels; ++lane)
+                for (int n = 0; n < length; ++n)
+                    frames[n][lane] = channels[lane][start + n];
+
+            switch (numGroups)
+            {
+                case 1:  processFrames<1 * laneGroup>(length); break;
+                case 2:  processFrames<2 * laneGroup>(length); break;
+                case 3:  processFrames<3 * laneGroup>(length); break;
+                default: processFrames<4 * laneGroup>(length); break;
+            }
+
+            for (int lane = 0; lane < numChannels; ++lane)
+                for (int n = 0; n < length; ++n)
+                    channels[lane][start + n] = frames[n][lane];
+        }
+
+        // A non-finite input would otherwise stay in the filter state for good.
+        for (int lane = 0; lane < numChannels; ++lane)
+        {
+            if (!DistortionProcessor::allFinite(channels[lane], numSamples))
+            {
+                resetLane(lane);
+                std::fill(channels[lane], channels[lane] + numSamples, 0.f);
+            }
+        }
+    }
+
+    void resetLane(int lane)
+    {
+        bjt.   resetLane(lane);
+        rc.    resetLane(lane);
+        toneLP.resetLane(lane);
+        toneHP.resetLane(lane);
+
+        s1[(size_t)lane] = s2[(size_t)lane] = 0.f;
+    }
+
+    // The filter state of one lane, for running the others without it.
+    struct LaneState
+    {
+        LaneBiquad<double>::State bjt;
+        LaneBiquad<float>::State rc, toneLP, toneHP;
+        float s1, s2;
+    };
+
+    LaneState getLaneState(int lane) const
+    {
+        return { bjt.getState(lane), rc.getState(lane), toneLP.getState(lane), toneHP.getState(lane),
+                 s1[(size_t)lane], s2[(size_t)lane] };
+    }
+
+    void setLaneState(int lane, const LaneState& state)
+    {
+        bjt.   setState(lane, state.bjt);
+        rc.    setState(lane, state.rc);
+        toneLP.setState(lane, state.toneLP);
+        toneHP.setState(lane, state.toneHP);
+
+        s1[(size_t)lane] = state.s1;
+        s2[(size_t)lane] = state.s2;
+    }
+
+private:
+    static_assert(maxLanes == 4 * laneGroup, "processFrames is dispatched for up to four groups");
+
+    template <int numLanes>
+    void processFrames(int length)
+    {
+        for (int n = 0; n < length; ++n)
+        {
+            // A local copy of the frame, so the compiler need not worry about it aliasing the state.
+            float x[numLanes];
+            std::copy(frames[n], frames[n] + numLanes, x);
+
+            bjt.process<numLanes>(x);
+
+            for (int l = 0; l < numLanes; ++l)
+                x[l] *= DistortionProcessor::bjtGain;
+
+            // Op-amp gain network, the SVF of OpAmpFilter with per-lane coefficients.
+            for (int l = 0; l < numLanes; ++l)
+            {
+                float hp = (x[l] - (k[l] + g[l]) * s1[l] - s2[l]) * d[l];
+                float v1 = g[l] * hp;
+                float bp = v1 + s1[l];
+                s1[l] = bp + v1;
+                float v2 = g[l] * bp;
+                float lp = v2 + s2[l];
+                s2[l] = lp + v2;
+
+                x[l] += m[l] * bp;
+            }
+
+            // saturateOpAmp and clipDiodes, without branches or library calls.
+            for (int l = 0; l < numLanes; ++l)
+            {
+                float rail = x[l] > 0.f ? 4.55f : 4.4f;
+                float saturated = rail * LaneMath::tanh(x[l] / rail);
+
+                x[l] = DistortionProcessor::aDiode * LaneMath::atan(saturated * DistortionProcessor::bDiode);
+            }
+
+            rc.process<numLanes>(x);
+
+            float highPassed[numLanes];
+            std::copy(x, x + numLanes, highPassed);
+
+            toneLP.process<numLanes>(x);
+            toneHP.process<numLanes>(highPassed);
+
+            for (int l = 0; l < numLanes; ++l)
+                frames[n][l] = (x[l] + tone[l] * (highPassed[l] - x[l])) * volume[l];
+        }
+    }
+
+    // The BJT high-pass sits too close to DC for float at oversampled rates.
+    LaneBiquad<double> bjt;
+    LaneBiquad<float>  rc, toneLP, toneHP;
+
+    std::array<float, maxLanes> gains{}, g{}, k{}, m{}, d{};
+    std::array<float, maxLanes> s1{}, s2{};
+    std::array<float, maxLanes> tone{}, volume{};
+
+    alignas(16) float frames[chunkSize][maxLanes];
+
+    double halfT{ 0.5 / 44100.0 };
+    int numGroups{ 0 };
+};
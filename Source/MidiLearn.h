@@ -0,0 +1,186 @@
+/*
+  ==============================================================================
+
+    MIDI learn for foot controllers: maps one CC each to Gain, Tone and Volume.
+
+    Setting the "MIDI Learn" parameter to a target assigns the next CC that
+    arrives to it. On the audio thread a CC costs one lookup in a 128-entry
+    table; its value is used right away as an override and handed to the
+    message thread, which writes it to the parameter on a timer. The override
+    stays in place until that has happened, so the audio thread never locks,
+    allocates or waits for the parameter to catch up.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+
+class MidiLearn  : private juce::Timer
+{
+public:
+    enum Target
+    {
+        none = -1,
+        gain,
+        tone,
+        volume,
+        numTargets
+    };
+
+    explicit MidiLearn(juce::AudioProcessorValueTreeState& apvts)
+    {
+        parameters[gain]   = apvts.getParameter("Gain");
+        parameters[tone]   = apvts.getParameter("Tone");
+        parameters[volume] = apvts.getParameter("Volume");
+
+        learnParameter = apvts.getParameter("MidiLearn");
+        learnTarget    = apvts.getRawParameterValue("MidiLearn");
+
+        for (auto& target : targetForController)
+            target.store(none);
+
+        for (auto& controller : controllerForTarget)
+            controller.store(-1);
+
+        startTimerHz(30);
+    }
+
+    ~MidiLearn() override
+    {
+        stopTimer();
+    }
+
+    // Audio thread. Returns true if the CC is mapped, i.e. a parameter changed.
+    bool handleController(int controller, int value)
+    {
+        if (controller < 0 || controller >= numControllers)
+            return false;
+
+        // "MIDI Learn" is Off, Gain, Tone, Volume. Only the first CC is
+        // learnt, until the message thread has switched it back to Off.
+        if (auto learning = (int)learnTarget->load() - 1; learning > none && !learnFinished.load())
+        {
+            assign(controller, learning);
+            learnFinished.store(true);
+        }
+
+        auto target = targetForController[(size_t)controller].load();
+
+        if (target == none)
+            return false;
+
+        auto& slot = slots[(size_t)target];
+        slot.value = parameters[(size_t)target]->convertFrom0to1((float)value / 127.f);
+
+        slot.pendingValue.store(slot.value);
+        slot.pendingSerial.store(++slot.serial);
+
+        return true;
+    }
+
+    // Audio thread. The CC value while it has not reached the parameter yet,
+    // parameterValue otherwise.
+    float getValue(Target target, float parameterValue) const
+    {
+        const auto& slot = slots[(size_t)target];
+        return slot.syncedSerial.load() == slot.serial ? parameterValue : slot.value;
+    }
+
+    int getController(Target target) const
+    {
+        return controllerForTarget[(size_t)target].load();
+    }
+
+    // Stored as <MidiMapping Gain="cc" Tone="cc" Volume="cc"/>, -1 when unmapped.
+    void writeTo(juce::XmlElement& parent) const
+    {
+        auto* mapping = parent.createNewChildElement(mappingTag);
+
+        for (int target = 0; target < numTargets; ++target)
+            mapping->setAttribute(targetNames[target], getController((Target)target));
+    }
+
+    void readFrom(const juce::XmlElement& parent)
+    {
+        for (auto& target : targetForController)
+            target.store(none);
+
+        for (auto& controller : controllerForTarget)
+            controller.store(-1);
+
+        if (auto* mapping = parent.getChildByName(mappingTag))
+            for (int target = 0; target < numTargets; ++target)
+                if (auto controller = mapping->getIntAttribute(targetNames[target], -1); controller >= 0 && controller < numControllers)
+                    assign(controller, target);
+    }
+
+    static constexpr const char* mappingTag = "MidiMapping";
+
+private:
+    static constexpr int numControllers = 128;
+    static constexpr const char* targetNames[numTargets] = { "Gain", "Tone", "Volume" };
+
+    // One CC per target: learning a new one forgets the old.
+    void assign(int controller, int target)
+    {
+        auto previous = controllerForTarget[(size_t)target].exchange(controller);
+
+        if (previous >= 0)
+            targetForController[(size_t)previous].store(none);
+
+        auto previousTarget = targetForController[(size_t)controller].exchange(target);
+
+        if (previousTarget != none && previousTarget != target)
+            controllerForTarget[(size_t)previousTarget].store(-1);
+    }
+
+    void timerCallback() override
+    {
+        for (int target = 0; target < numTargets; ++target)
+        {
+            auto& slot = slots[(size_t)target];
+            auto serial = slot.pendingSerial.load();
+
+            if (serial == slot.syncedSerial.load())
+                continue;
+
+            auto* parameter = parameters[(size_t)target];
+            parameter->setValueNotifyingHost(parameter->convertTo0to1(slot.pendingValue.load()));
+            slot.syncedSerial.store(serial);
+        }
+
+        if (learnFinished.load())
+        {
+            learnParameter->setValueNotifyingHost(0.f);
+            learnFinished.store(false);
+        }
+    }
+
+    struct Slot
+    {
+        // Audio thread only.
+        float value{ 0.f };
+        uint32_t serial{ 0 };
+
+        // Handed to the message thread; the value is written before its serial.
+        std::atomic<float> pendingValue{ 0.f };
+        std::atomic<uint32_t> pendingSerial{ 0 };
+        std::atomic<uint32_t> syncedSerial{ 0 };
+    };
+
+    std::array<juce::RangedAudioParameter*, numTargets> parameters{};
+    juce::RangedAudioParameter* learnParameter = nullptr;
+    std::atomic<float>* learnTarget = nullptr;
+
+    std::array<std::atomic<int>, numControllers> targetForController;
+    std::array<std::atomic<int>, numTargets> controllerForTarget;
+    std::array<Slot, numTargets> slots;
+
+    std::atomic<bool> learnFinished{ false };
+
+    JUCE_DECLARE_NON_COPYABLE(MidiLearn)
+};
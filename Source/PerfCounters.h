@@ -0,0 +1,396 @@
+/*
+  ==============================================================================
+
+    Optional timing counters for the parameter and sample paths.
+
+    Build with DISTORTION_ENABLE_PERF_COUNTERS=1 to accumulate the cost of each
+    instrumented section (coefficient updates, processBlock per block size)
+    across all instances. A summary is written to the log when the last
+    processor is destroyed. Without the flag the macros expand to nothing.
+
+    Tools/Benchmarks.cpp runs the processor through fixed scenarios outside a
+    host, for numbers that can be reproduced, stores them as JSON and compares
+    them against a baseline:
+
+      DistortionBenchmarks --output current.json --baseline baseline.json
+
+    It exits with an error when any section is slower than in the baseline by
+    more than --threshold percent (default 10).
+
+    On Linux its --hw option additionally wraps the kernel benchmarks in
+    hardware counters (cycles, instructions, L1D and LLC misses, branch
+    misses) via perf_event_open. This needs perf_event_paranoid <= 2.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+
+#include <limits>
+
+#if JUCE_LINUX
+ #include <linux/perf_event.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#endif
+
+// Hardware counters of the calling thread, read as one group so all values
+// cover exactly the same code. Counters the CPU or kernel does not offer
+// read as -1; on other platforms nothing is opened and isValid() is false.
+struct HardwareCounters
+{
+    enum Counter { cycles, instructions, l1dMisses, llcMisses, branchMisses, numCounters };
+    using Values = std::array<int64_t, numCounters>;
+
+    static const char* getName(int counter)
+    {
+        static const char* names[] = { "cycles", "instructions", "l1dMisses", "llcMisses", "branchMisses" };
+        return names[counter];
+    }
+
+    HardwareCounters()
+    {
+        fds.fill(-1);
+        groupIndex.fill(-1);
+
+       #if JUCE_LINUX
+        const std::array<std::pair<uint32_t, uint64_t>, numCounters> events{ {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+        } };
+
+        int numOpened = 0;
+
+        for (int i = 0; i < numCounters; ++i)
+        {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = events[(size_t)i].first;
+            attr.config = events[(size_t)i].second;
+            attr.disabled = fds[0] < 0 ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            auto fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, fds[0] < 0 ? -1 : fds[0], 0);
+
+            // Without cycles as the group leader there is nothing to compare against.
+            if (fd < 0 && i == cycles)
+                return;
+
+            fds[(size_t)i] = fd;
+
+            if (fd >= 0)
+                groupIndex[(size_t)i] = numOpened++;
+        }
+       #endif
+    }
+
+    ~HardwareCounters()
+    {
+       #if JUCE_LINUX
+        for (auto fd : fds)
+            if (fd >= 0)
+                close(fd);
+       #endif
+    }
+
+    bool isValid() const { return fds[0] >= 0; }
+
+    void start()
+    {
+       #if JUCE_LINUX
+        ioctl(fds[0], PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+       #endif
+    }
+
+    Values stop()
+    {
+        Values values;
+        values.fill(-1);
+
+       #if JUCE_LINUX
+        ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        // PERF_FORMAT_GROUP layout: number of events, then one value per event.
+        std::array<uint64_t, numCounters + 1> data{};
+
+        if (read(fds[0], data.data(), sizeof(data)) > 0)
+            for (int i = 0; i < numCounters; ++i)
+                if (groupIndex[(size_t)i] >= 0)
+                    values[(size_t)i] = (int64_t)data[(size_t)groupIndex[(size_t)i] + 1];
+       #endif
+
+        return values;
+    }
+
+private:
+    std::array<int, numCounters> fds;
+    std::array<int, numCounters> groupIndex;
+
+    JUCE_DECLARE_NON_COPYABLE(HardwareCounters)
+};
+
+struct PerfSection
+{
+    explicit PerfSection(const juce::String& sectionName) : name(sectionName)
+    {
+        for (auto& total : hardwareTotals)
+            total.store(0);
+
+        for (auto& runs : hardwareRuns)
+            runs.store(0);
+    }
+
+    // Counters the run could not read are left out of their average.
+    void addHardwareRun(const HardwareCounters::Values& values)
+    {
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            if (values[i] < 0)
+                continue;
+
+            hardwareRuns[i].fetch_add(1, std::memory_order_relaxed);
+            hardwareTotals[i].fetch_add(values[i], std::memory_order_relaxed);
+        }
+    }
+
+    // Average count per run that read the counter, or -1 when none did.
+    double getHardwareAverage(int counter) const
+    {
+        auto runs = hardwareRuns[(size_t)counter].load();
+        return runs > 0 ? (double)hardwareTotals[(size_t)counter].load() / (double)runs : -1.0;
+    }
+
+    void addRun(int64_t ticks)
+    {
+        numRuns.fetch_add(1, std::memory_order_relaxed);
+        totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+
+        auto currentMin = minTicks.load(std::memory_order_relaxed);
+        while (ticks < currentMin && !minTicks.compare_exchange_weak(currentMin, ticks, std::memory_order_relaxed)) {}
+
+        auto currentMax = maxTicks.load(std::memory_order_relaxed);
+        while (ticks > currentMax && !maxTicks.compare_exchange_weak(currentMax, ticks, std::memory_order_relaxed)) {}
+    }
+
+    double ticksToMicroseconds(int64_t ticks) const
+    {
+        return juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e6;
+    }
+
+    double getAverageMicroseconds() const
+    {
+        auto runs = numRuns.load();
+        return runs > 0 ? ticksToMicroseconds(totalTicks.load()) / (double)runs : 0.0;
+    }
+
+    juce::String toString() const
+    {
+        auto text = name
+                  + ": runs "  + juce::String((int)numRuns.load())
+                  + ", avg "   + juce::String(getAverageMicroseconds(), 3)
+                  + " us, min " + juce::String(ticksToMicroseconds(minTicks.load()), 3)
+                  + " us, max " + juce::String(ticksToMicroseconds(maxTicks.load()), 3) + " us";
+
+        for (int i = 0; i < HardwareCounters::numCounters; ++i)
+            if (getHardwareAverage(i) >= 0.0)
+                text += ", " + juce::String(HardwareCounters::getName(i)) + " " + juce::String(getHardwareAverage(i), 0);
+
+        if (getHardwareAverage(HardwareCounters::cycles) > 0.0 && getHardwareAverage(HardwareCounters::instructions) >= 0.0)
+            text += ", IPC " + juce::String(getHardwareAverage(HardwareCounters::instructions)
+                                            / getHardwareAverage(HardwareCounters::cycles), 2);
+
+        return text;
+    }
+
+    const juce::String name;
+    std::atomic<int64_t> numRuns{ 0 };
+    std::atomic<int64_t> totalTicks{ 0 };
+    std::atomic<int64_t> minTicks{ std::numeric_limits<int64_t>::max() };
+    std::atomic<int64_t> maxTicks{ 0 };
+
+    // Per counter: the runs that read it, and their sum.
+    std::array<std::atomic<int64_t>, HardwareCounters::numCounters> hardwareRuns;
+    std::array<std::atomic<int64_t>, HardwareCounters::numCounters> hardwareTotals;
+};
+
+class PerfRegistry
+{
+public:
+    static PerfRegistry& getInstance()
+    {
+        static PerfRegistry registry;
+        return registry;
+    }
+
+    // Every processor is a client; the last one to go logs the summary. This
+    // class's own destructor runs at library unload, when logging is no
+    // longer safe, so it does nothing.
+    void addClient()    { ++numClients; }
+
+    void removeClient()
+    {
+        if (--numClients == 0)
+            logSummary();
+    }
+
+    // Sections live as long as the registry, so callers may keep the reference.
+    // Takes a lock: look sections up outside the audio callback.
+    PerfSection& getSection(const juce::String& name)
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (auto* section : sections)
+            if (section->name == name)
+                return *section;
+
+        return *sections.add(new PerfSection(name));
+    }
+
+    void logSummary()
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (auto* section : sections)
+            if (section->numRuns.load() > 0)
+                juce::Logger::writeToLog(section->toString());
+    }
+
+    juce::var toJson()
+    {
+        const juce::ScopedLock sl(lock);
+
+        juce::DynamicObject::Ptr results = new juce::DynamicObject();
+
+        for (auto* section : sections)
+        {
+            if (section->numRuns.load() == 0)
+                continue;
+
+            juce::DynamicObject::Ptr entry = new juce::DynamicObject();
+            entry->setProperty("runs",  (juce::int64)section->numRuns.load());
+            entry->setProperty("avgUs", section->getAverageMicroseconds());
+            entry->setProperty("minUs", section->ticksToMicroseconds(section->minTicks.load()));
+            entry->setProperty("maxUs", section->ticksToMicroseconds(section->maxTicks.load()));
+
+            for (int i = 0; i < HardwareCounters::numCounters; ++i)
+                if (section->getHardwareAverage(i) >= 0.0)
+                    entry->setProperty(HardwareCounters::getName(i), section->getHardwareAverage(i));
+
+            results->setProperty(section->name, entry.get());
+        }
+
+        return results.get();
+    }
+
+    bool writeJson(const juce::File& file)
+    {
+        return file.replaceWithText(juce::JSON::toString(toJson()));
+    }
+
+    // Returns the number of sections slower than the baseline by more than thresholdPercent.
+    int compareWithBaseline(const juce::File& baselineFile, double thresholdPercent)
+    {
+        auto baseline = juce::JSON::parse(baselineFile);
+        auto* baselineObject = baseline.getDynamicObject();
+
+        if (baselineObject == nullptr)
+        {
+            juce::Logger::writeToLog("perf: could not read baseline " + baselineFile.getFullPathName());
+            return 0;
+        }
+
+        auto current = toJson();
+        int numRegressions = 0;
+
+        for (auto& entry : baselineObject->getProperties())
+        {
+            auto currentEntry = current[entry.name];
+
+            if (currentEntry.isVoid())
+                continue;
+
+            double baselineUs = entry.value["avgUs"];
+            double currentUs  = currentEntry["avgUs"];
+
+            if (baselineUs <= 0.0)
+                continue;
+
+            auto changePercent = (currentUs / baselineUs - 1.0) * 100.0;
+
+            if (changePercent > thresholdPercent)
+            {
+                ++numRegressions;
+                juce::Logger::writeToLog("perf: REGRESSION " + entry.name.toString()
+                                         + ": " + juce::String(currentUs, 3) + " us vs baseline "
+                                         + juce::String(baselineUs, 3) + " us (+" + juce::String(changePercent, 1) + "%)");
+            }
+        }
+
+        juce::Logger::writeToLog("perf: " + juce::String(numRegressions) + " regression(s) above "
+                                 + juce::String(thresholdPercent, 1) + "%");
+
+        return numRegressions;
+    }
+
+private:
+    PerfRegistry() = default;
+
+    juce::CriticalSection lock;
+    juce::OwnedArray<PerfSection> sections;
+    std::atomic<int> numClients{ 0 };
+};
+
+// Measures nothing when section is null, e.g. processBlock before prepareToPlay.
+struct ScopedPerfMeasurement
+{
+    explicit ScopedPerfMeasurement(PerfSection* s, HardwareCounters* counters = nullptr)
+        : section(s), hardwareCounters(s != nullptr ? counters : nullptr)
+    {
+        if (hardwareCounters != nullptr)
+            hardwareCounters->start();
+
+        startTicks = juce::Time::getHighResolutionTicks();
+    }
+
+    ~ScopedPerfMeasurement()
+    {
+        if (section == nullptr)
+            return;
+
+        auto elapsed = juce::Time::getHighResolutionTicks() - startTicks;
+
+        if (hardwareCounters != nullptr)
+            section->addHardwareRun(hardwareCounters->stop());
+
+        section->addRun(elapsed);
+    }
+
+    PerfSection* section;
+    HardwareCounters* hardwareCounters;
+    int64_t startTicks;
+};
+
+ #define DISTORTION_PERF_SCOPE(name) \
+    static auto& JUCE_JOIN_MACRO(perfSection_, __LINE__) = PerfRegistry::getInstance().getSection(name); \
+    const ScopedPerfMeasurement JUCE_JOIN_MACRO(perfScope_, __LINE__) (&JUCE_JOIN_MACRO(perfSection_, __LINE__));
+
+ #define DISTORTION_PERF_SECTION_SCOPE(sectionPointer) \
+    const ScopedPerfMeasurement JUCE_JOIN_MACRO(perfScope_, __LINE__) (sectionPointer);
+
+#else
+ #define DISTORTION_PERF_SCOPE(name)
+ #define DISTORTION_PERF_SECTION_SCOPE(sectionPointer)
+#endif
@@ -12,20 +12,56 @@
 //==============================================================================
 DistortionPluginAudioProcessor::DistortionPluginAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
-     : AudioProcessor (BusesProperties()
-                     #if ! JucePlugin_IsMidiEffect
-                      #if ! JucePlugin_IsSynth
-                       .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
-                      #endif
-                       .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
-                     #endif
-                       )
+     : AudioProcessor (createBusesProperties())
 #endif
 {
+    for (int track = 1; track < maxTrackBuses; ++track)
+    {
+        const auto number = juce::String(track + 1);
+
+        trackParameters[(size_t)track].gain   = apvts.getRawParameterValue("Gain"   + number);
+        trackParameters[(size_t)track].tone   = apvts.getRawParameterValue("Tone"   + number);
+        trackParameters[(size_t)track].volume = apvts.getRawParameterValue("Volume" + number);
+    }
+
+   #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+    PerfRegistry::getInstance().addClient();
+   #endif
 }
 
 DistortionPluginAudioProcessor::~DistortionPluginAudioProcessor()
 {
+   #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+    PerfRegistry::getInstance().removeClient();
+   #endif
+}
+
+juce::AudioProcessor::BusesProperties DistortionPluginAudioProcessor::createBusesProperties()
+{
+    BusesProperties buses;
+
+   #if ! JucePlugin_IsMidiEffect
+    #if ! JucePlugin_IsSynth
+    // A guitar goes straight into the standalone app, so it starts mono in / stereo out.
+    buses = buses.withInput ("Input",  juce::JUCEApplicationBase::isStandaloneApp() ? juce::AudioChannelSet::mono()
+                                                                                   : juce::AudioChannelSet::stereo(), true)
+                 .withInput ("Sidechain", juce::AudioChannelSet::stereo(), false);
+    #endif
+    buses = buses.withOutput ("Output", juce::AudioChannelSet::stereo(), true);
+
+    // Extra tracks come after the sidechain, so its bus index stays 1.
+    #if ! JucePlugin_IsSynth
+    for (int track = 1; track < maxTrackBuses; ++track)
+    {
+        const auto name = "Track " + juce::String(track + 1);
+
+        buses = buses.withInput  (name, juce::AudioChannelSet::stereo(), false)
+                     .withOutput (name, juce::AudioChannelSet::stereo(), false);
+    }
+    #endif
+   #endif
+
+    return buses;
 }
 
 //==============================================================================
@@ -63,7 +99,7 @@ bool DistortionPluginAudioProcessor::isMidiEffect() const
 
 double DistortionPluginAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    return DistortionProcessor::getTailLengthSeconds();
 }
 
 int DistortionPluginAudioProcessor::getNumPrograms()
@@ -91,39 +127,184 @@ void DistortionPluginAudioProcessor::changeProgramName (int index, const juce::S
 }
 
 //==============================================================================
+EngineConfig DistortionPluginAudioProcessor::createEngineConfig(double sampleRate, int samplesPerBlock) const
+{
+    EngineConfig config;
+    config.sampleRate         = sampleRate;
+    config.numChannels        = juce::jmax(1, getMainBusNumInputChannels());
+    config.oversamplingStages = getOversamplingStages(sampleRate);
+    config.maxBlockSize       = juce::jmax(1, samplesPerBlock);
+
+    return config;
+}
+
+// For the main set's analog config, before any Mode is applied.
+void DistortionPluginAudioProcessor::setOfflineOptions(EngineConfig& config) const
+{
+    // Offline renders with big blocks may get the FFT oversampler: a cleaner
+    // stopband and linear phase, for latency nobody waits for there. Without
+    // oversampling it would only pad the block.
+    config.fftOversampling = isNonRealtime() && offlineFftParameter->load() >= 0.5f
+                             && config.maxBlockSize >= minFftBlockSize && config.oversamplingStages > 0;
+
+    // Both modes report the latency of the slower one, so switching between
+    // them in processBlock leaves it alone.
+    config.latencySamples = config.fftOversampling ? FftOversampler::latencySamples
+                                                   : juce::jmax(getOversamplerLatency(config.oversamplingStages),
+                                                                getOversamplerLatency(getOversamplingStages(config.sampleRate, true)));
+}
+
 void DistortionPluginAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    const int numChannels = getTotalNumInputChannels();
-    const int oversampleStages = 3;
+    auto config = createEngineConfig(sampleRate, samplesPerBlock);
 
-    oversampler.reset(new juce::dsp::Oversampling<float>(
-        (size_t)numChannels,
-        oversampleStages,
-        juce::dsp::Oversampling<float>::FilterType::filterHalfBandPolyphaseIIR,
-        true)
-    );
+    // The lanes of the multi-bus and batched engines only have the analog curve.
+    const auto laneConfig = config;
+
+    setOfflineOptions(config);
+
+    config.polynomial = (int)modeParameter->load() == polynomialMode;
+    config.oversamplingStages = getOversamplingStages(sampleRate, config.polynomial);
+
+    fadingEngines.reset();
+    fadeSamplesRemaining = 0;
+    fadeLengthSamples = juce::jmax(1, (int)(sampleRate * EngineSet::crossfadeSeconds));
+
+    activeEngines = engineBuilder.buildNow(config);
+    lastRequestedConfig = config;
+
+    activeEngines->updateParameters(loadParameters());
 
+    // Lane map for multi-bus mode: two per enabled track from track 2 on. The
+    // main track keeps its engine set and all its modulation.
+    multiBusEngines.reset();
+    trackFirstLane.fill(0);
+    trackNumLanes.fill(0);
 
-    oversampler->initProcessing(samplesPerBlock);
-    auto ovRate = oversampler->getOversamplingFactor();
-    double ovSampleRate = sampleRate * ovRate;
+    int numLanes = 0;
 
-    for (auto& engine : distortionEngine)
+    for (int track = 1; track < maxTrackBuses; ++track)
     {
-        engine.prepare(ovSampleRate);
+        auto* input  = getBus(true,  getTrackInputBus(track));
+        auto* output = getBus(false, getTrackOutputBus(track));
+
+        if (input == nullptr || output == nullptr || !input->isEnabled() || !output->isEnabled())
+            continue;
+
+        trackFirstLane[(size_t)track] = numLanes;
+        trackNumLanes[(size_t)track]  = input->getNumberOfChannels();
+        numLanes += input->getNumberOfChannels();
     }
 
+    if (numLanes > 0)
+    {
+        auto multiBusConfig = laneConfig;
+        multiBusConfig.numChannels = numLanes;
+        multiBusConfig.latencySamples = activeEngines->getLatencyInSamples();
+
+        multiBusEngines = std::make_unique<MultiBusEngineSet>(multiBusConfig);
+    }
+
+    // Leave the batcher before joining again, or the old lanes would be in the way.
+    batchedEngine.reset();
+
+    // The lanes only have the analog curve, so other Modes run on their own.
+    if (multiBusEngines == nullptr && batchingParameter->load() >= 0.5f && (int)modeParameter->load() == analogMode)
+    {
+        batchedEngine = std::make_unique<BatchedEngine>(laneConfig);
+        batchedEngine->setParameters(loadParameters());
+
+        if (!batchedEngine->isBatched())
+            batchedEngine.reset();
+    }
+
+    // Rebuilds in processBlock keep config.latencySamples and fftOversampling,
+    // so this stays valid until the next prepareToPlay, which is also where a
+    // switch to or from offline rendering takes effect. The track lanes are
+    // padded to match.
+    if (batchedEngine != nullptr)
+        setLatencySamples(batchedEngine->getLatencyInSamples());
+    else
+        setLatencySamples(activeEngines->getLatencyInSamples());
+
+   #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+    auto ovRate = activeEngines->getOversamplingFactor();
+
+    blockPerfSection = &PerfRegistry::getInstance().getSection("processBlock/" + juce::String(samplesPerBlock)
+                                                                + "/x" + juce::String((int)ovRate));
+    parameterPerfSection = &PerfRegistry::getInstance().getSection("updateParameters/x" + juce::String((int)ovRate));
+   #endif
+}
+
+int DistortionPluginAudioProcessor::getOversamplingStages(double sampleRate, bool polynomial)
+{
+    // Halve the factor until the internal rate fits, so 44.1/48 kHz sessions
+    // keep 8x while 96 kHz runs at 4x and 192 kHz at 2x.
+    int stages = maxOversamplingStages;
+
+    while (stages > 0 && sampleRate * (double)(1 << stages) > maxOversampledRate * 1.001)
+        --stages;
+
+    // The polynomial needs no more than keeps its harmonics out of the audio
+    // band, and gets no more than Analog. Only rates like 64 kHz, where the
+    // cap halves the factor it needs, let its top harmonics fold into the band.
+    if (polynomial)
+        return juce::jmin(stages, PolynomialShaper::getOversamplingStages(sampleRate));
 
-    auto params = getDistortionParameters(apvts);
+    return stages;
+}
+
+int DistortionPluginAudioProcessor::getOversamplerLatency(int stages)
+{
+    // The filters are designed in the constructor; asking needs no buffers.
+    juce::dsp::Oversampling<float> oversampler(1, (size_t)stages,
+                                               juce::dsp::Oversampling<float>::FilterType::filterHalfBandPolyphaseIIR,
+                                               true);
 
-    for (auto& engine : distortionEngine)
-        engine.updateParameters(params);
+    return juce::roundToInt(oversampler.getLatencyInSamples());
 }
 
 void DistortionPluginAudioProcessor::releaseResources()
 {
-    // When playback stops, you can use this as an opportunity to free up any
-    // spare memory, etc.
+    // Instances on muted or inactive tracks keep nothing but their parameters;
+    // prepareToPlay builds everything again, as it would anyway.
+   #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+    juce::Logger::writeToLog("releaseResources: freeing " + juce::String((juce::int64)getEngineMemoryBytes())
+                             + " bytes of engines, " + juce::String((juce::int64)sizeof(*this))
+                             + " bytes of processor stay");
+   #endif
+
+    engineBuilder.discard();
+
+    activeEngines.reset();
+    fadingEngines.reset();
+    fadeSamplesRemaining = 0;
+    lastRequestedConfig = {};
+
+    multiBusEngines.reset();
+    batchedEngine.reset();
+}
+
+size_t DistortionPluginAudioProcessor::getEngineMemoryBytes() const
+{
+    size_t bytes = 0;
+
+    for (auto* set : { activeEngines.get(), fadingEngines.get() })
+        if (set != nullptr)
+            bytes += set->getAllocatedBytes();
+
+    if (multiBusEngines != nullptr)
+        bytes += multiBusEngines->getAllocatedBytes();
+
+    if (batchedEngine != nullptr)
+        bytes += batchedEngine->getAllocatedBytes();
+
+    return bytes;
+}
+
+FreezeFitter::Report DistortionPluginAudioProcessor::getFreezeReport() const
+{
+    return freezeFitter.getReport();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -141,10 +322,30 @@ bool DistortionPluginAudioProcessor::isBusesLayoutSupported (const BusesLayout&
      && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
         return false;
 
-    // This checks if the input layout matches the output layout
+    // This checks if the input layout matches the output layout,
+    // apart from mono in / stereo out, which processes once and duplicates.
    #if ! JucePlugin_IsSynth
-    if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
+    if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet()
+     && layouts.getMainInputChannelSet()  != juce::AudioChannelSet::mono())
+        return false;
+
+    // The sidechain only feeds an envelope, so any width up to stereo will do.
+    if (layouts.inputBuses.size() > 1
+     && layouts.getChannelSet(true, 1).size() > 2)
         return false;
+
+    // Extra tracks are stereo in and out, or off.
+    for (int track = 1; track < maxTrackBuses; ++track)
+    {
+        if (getTrackInputBus(track) >= layouts.inputBuses.size() || getTrackOutputBus(track) >= layouts.outputBuses.size())
+            break;
+
+        auto input  = layouts.getChannelSet(true,  getTrackInputBus(track));
+        auto output = layouts.getChannelSet(false, getTrackOutputBus(track));
+
+        if (input != output || (!input.isDisabled() && input != juce::AudioChannelSet::stereo()))
+            return false;
+    }
    #endif
 
     return true;
@@ -155,40 +356,330 @@ bool DistortionPluginAudioProcessor::isBusesLayoutSupported (const BusesLayout&
 void DistortionPluginAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
     juce::ScopedNoDenormals noDenormals;
+    DISTORTION_PERF_SECTION_SCOPE(blockPerfSection);
+
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
+    auto mainNumInputChannels   = getMainBusNumInputChannels();
 
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
 
-    auto params = getDistortionParameters(apvts);
+    // NaN or infinite input would stay in the oversampler's filters, which no
+    // engine reset reaches.
+    for (auto i = 0; i < juce::jmin(totalNumInputChannels, buffer.getNumChannels()); ++i)
+        if (!DistortionProcessor::allFinite(buffer.getReadPointer(i), buffer.getNumSamples()))
+            buffer.clear (i, 0, buffer.getNumSamples());
+
+    // Delivers any worker wake-up that adding a job could not.
+    workerPool->wakeIfPending();
+
+    if (activeEngines == nullptr || buffer.getNumSamples() == 0)
+        return;
+
+    if (batchedEngine != nullptr)
+    {
+        processBatched(buffer, midiMessages);
+        return;
+    }
+
+    swapInBuiltEngines();
+
+    const auto mode = (int)modeParameter->load();
+
+    // Ask for a set that fits when the layout or the Mode changed or the host
+    // sends more samples than the current set was built for; until it
+    // arrives, process what fits.
+    auto wanted = activeEngines->config;
+    wanted.numChannels  = juce::jmax(wanted.numChannels,  juce::jmin(mainNumInputChannels, buffer.getNumChannels()));
+    wanted.maxBlockSize = juce::jmax(wanted.maxBlockSize, buffer.getNumSamples());
+    wanted.polynomial   = mode == polynomialMode;
+    wanted.oversamplingStages = getOversamplingStages(wanted.sampleRate, wanted.polynomial);
+
+    if (wanted != activeEngines->config && wanted != lastRequestedConfig)
+    {
+        engineBuilder.request(wanted);
+        lastRequestedConfig = wanted;
+    }
+
+    // Freeze runs the analog set's oversampling; the sets fall back to their
+    // engines whenever the model does not fit the parameters.
+    if (mode == freezeMode)
+    {
+        freezeFitter.update(loadParameters(), activeEngines->config.sampleRate,
+                            activeEngines->getOversamplingFactor(), buffer.getNumSamples());
+        freezeFitter.takeFitted(freezeModel);
+    }
+
+    for (auto* set : { activeEngines.get(), fadingEngines.get() })
+        if (set != nullptr)
+            set->setFreezeModel(mode == freezeMode ? &freezeModel : nullptr);
+
+    auto updateEngineParameters = [this]
+    {
+        DISTORTION_PERF_SECTION_SCOPE(parameterPerfSection);
+
+        auto params = loadParameters();
+        activeEngines->updateParameters(params);
+
+        if (fadingEngines != nullptr)
+            fadingEngines->updateParameters(params);
+    };
+
+    updateEngineParameters();
+
+    auto mainInput = getBusBuffer(buffer, true, 0);
+    auto sidechainInput = getBusCount(true) > 1 ? getBusBuffer(buffer, true, 1) : juce::AudioBuffer<float>();
+
+    const auto numChannels = juce::jmin((size_t)mainInput.getNumChannels(),
+                                        (size_t)activeEngines->config.numChannels);
+
+    juce::dsp::AudioBlock<float> block(mainInput);
+    block = block.getSubsetChannelBlock(0, numChannels);
+
+    // Read at the base rate only; it never goes through the oversampler.
+    juce::dsp::AudioBlock<float> sidechain(sidechainInput);
+
+    const auto numSamples = block.getNumSamples();
+
+    // The LFO follows the song position while the host plays and keeps
+    // running at the last known tempo otherwise. LfoRate 0..4 is 1/1..1/16.
+    const auto cyclesPerBeat = (double)(1 << (int)lfoRateParameter->load()) / 4.0;
+
+    if (auto* playHead = getPlayHead())
+    {
+        if (auto position = playHead->getPosition())
+        {
+            if (auto bpm = position->getBpm())
+                lfoTempo = *bpm;
+
+            if (auto ppq = position->getPpqPosition(); ppq && position->getIsPlaying())
+                lfoPhase = *ppq * cyclesPerBeat;
+        }
+    }
+
+    const auto lfoIncrement = lfoTempo / 60.0 * cyclesPerBeat / activeEngines->config.sampleRate;
+
+    // Mapped CCs split the block, so each takes effect on its own sample.
+    size_t position = 0;
+
+    for (const auto metadata : midiMessages)
+    {
+        if (metadata.numBytes != 3 || (metadata.data[0] & 0xf0) != 0xb0)
+            continue;
+
+        if (!midiLearn.handleController(metadata.data[1], metadata.data[2]))
+            continue;
 
-    juce::dsp::AudioBlock<float> block(buffer);
+        auto eventPosition = juce::jlimit(position, numSamples, (size_t)juce::jmax(0, metadata.samplePosition));
+        processRange(block, sidechain, position, eventPosition, lfoIncrement);
+        position = eventPosition;
 
-    auto oversampledBlock = oversampler->processSamplesUp(block);
+        updateEngineParameters();
+    }
+
+    processRange(block, sidechain, position, numSamples, lfoIncrement);
+
+    lfoPhase += (double)numSamples * lfoIncrement;
+    lfoPhase -= std::floor(lfoPhase);
+
+    // Deletion happens on the builder thread; if it has not collected the
+    // previous set yet, try again next block.
+    if (fadingEngines != nullptr && fadeSamplesRemaining == 0)
+        engineBuilder.retire(fadingEngines);
+
+    // Mono in / stereo out: the input channel was processed once, copy it
+    // out. Only to the main outputs: the other channels are track buses.
+    if (mainNumInputChannels == 1)
+        for (auto i = 1; i < juce::jmin(getMainBusNumOutputChannels(), buffer.getNumChannels()); ++i)
+            buffer.copyFrom(i, 0, buffer, 0, 0, buffer.getNumSamples());
+
+    // After the main track, which reads the sidechain from channels that the
+    // second track's output shares.
+    if (multiBusEngines != nullptr)
+        processMultiBus(buffer);
+}
+
+DistortionParameters DistortionPluginAudioProcessor::loadParameters() const
+{
+    DistortionParameters params;
+    params.gain   = midiLearn.getValue(MidiLearn::gain,   gainParameter->load());
+    params.tone   = midiLearn.getValue(MidiLearn::tone,   toneParameter->load());
+    params.volume = midiLearn.getValue(MidiLearn::volume, volumeParameter->load());
+    params.envelope = envelopeParameter->load();
+    params.controlInterval = DistortionProcessor::minControlInterval << (int)controlIntervalParameter->load();
+    params.lfoGain = lfoGainParameter->load();
+    params.lfoTone = lfoToneParameter->load();
+    params.sidechain = sidechainParameter->load();
+
+    return params;
+}
+
+DistortionParameters DistortionPluginAudioProcessor::loadTrackParameters(int track) const
+{
+    jassert(track > 0);
+
+    const auto& parameters = trackParameters[(size_t)track];
+
+    DistortionParameters params;
+    params.gain   = parameters.gain->load();
+    params.tone   = parameters.tone->load();
+    params.volume = parameters.volume->load();
 
-    for (int channel = 0; channel < totalNumInputChannels; ++channel)
+    return params;
+}
+
+// Batched mode: mapped CCs apply from the start of the block.
+void DistortionPluginAudioProcessor::handleControllers(const juce::MidiBuffer& midiMessages)
+{
+    for (const auto metadata : midiMessages)
+        if (metadata.numBytes == 3 && (metadata.data[0] & 0xf0) == 0xb0)
+            midiLearn.handleController(metadata.data[1], metadata.data[2]);
+}
+
+// Multi-bus mode, tracks 2 and up. Each only gets Gain, Tone and Volume: the
+// envelope, LFO and sidechain modulation need per-lane control-rate updates
+// that the lanes do not have.
+void DistortionPluginAudioProcessor::processMultiBus(juce::AudioBuffer<float>& buffer)
+{
+    auto& lanes = multiBusEngines->lanes;
+    auto& laneBuffer = multiBusEngines->laneBuffer;
+
+    for (int track = 1; track < maxTrackBuses; ++track)
     {
-        //auto* channelData = buffer.getWritePointer (channel);
+        const auto params = loadTrackParameters(track);
 
-        //auto& engine = distortionEngine[static_cast<size_t>(std::min(channel, 1))];
-        auto& engine = distortionEngine[channel];
+        for (int ch = 0; ch < trackNumLanes[(size_t)track]; ++ch)
+            lanes.setParameters(trackFirstLane[(size_t)track] + ch, params);
+    }
+
+    const auto numSamples = buffer.getNumSamples();
+    const auto maxBlockSize = multiBusEngines->config.maxBlockSize;
 
-        engine.updateParameters(params);
+    for (int start = 0; start < numSamples; start += maxBlockSize)
+    {
+        const auto length = juce::jmin(maxBlockSize, numSamples - start);
 
-       /* for (int sample = 0; sample < buffer.getNumSamples(); sample++)
+        // Gather every input before writing any output.
+        for (int track = 1; track < maxTrackBuses; ++track)
         {
-            channelData[sample] = engine.processSample(channelData[sample]);
+            auto input = getBusBuffer(buffer, true, getTrackInputBus(track));
+
+            for (int ch = 0; ch < juce::jmin(trackNumLanes[(size_t)track], input.getNumChannels()); ++ch)
+                laneBuffer.copyFrom(trackFirstLane[(size_t)track] + ch, 0, input, ch, start, length);
         }
-        */
 
-        //juce::dsp::AudioBlock<float> channelBlock(oversampledBlock.getSingleChannelBlock(channel));
-        auto channelBlock = oversampledBlock.getSingleChannelBlock(channel);
+        juce::dsp::AudioBlock<float> block(laneBuffer);
+        block = block.getSubBlock(0, (size_t)length);
+
+        multiBusEngines->process(block);
+
+        for (int track = 1; track < maxTrackBuses; ++track)
+        {
+            if (trackNumLanes[(size_t)track] == 0)
+                continue;
+
+            auto output = getBusBuffer(buffer, false, getTrackOutputBus(track));
+
+            for (int ch = 0; ch < output.getNumChannels(); ++ch)
+                output.copyFrom(ch, start, laneBuffer,
+                                trackFirstLane[(size_t)track] + juce::jmin(ch, trackNumLanes[(size_t)track] - 1), 0, length);
+        }
+    }
+}
+
+// Batched mode: the lanes code again, so like multi-bus mode without the
+// envelope, LFO and sidechain modulation.
+void DistortionPluginAudioProcessor::processBatched(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    handleControllers(midiMessages);
+    batchedEngine->setParameters(loadParameters());
+
+    auto mainInput = getBusBuffer(buffer, true, 0);
+    juce::dsp::AudioBlock<float> block(mainInput);
+
+    batchedEngine->process(block);
+
+    // Mono in / stereo out: the input channel was processed once, copy it out.
+    if (getMainBusNumInputChannels() == 1)
+        for (auto i = 1; i < juce::jmin(getTotalNumOutputChannels(), buffer.getNumChannels()); ++i)
+            buffer.copyFrom(i, 0, buffer, 0, 0, buffer.getNumSamples());
+}
+
+// Processes samples [begin, end) of block, in pieces the engine sets can take.
+void DistortionPluginAudioProcessor::processRange(juce::dsp::AudioBlock<float>& block, juce::dsp::AudioBlock<float>& sidechain,
+                                                  size_t begin, size_t end, double lfoIncrement)
+{
+    // Some hosts send more samples than announced in prepareToPlay, which the
+    // oversampler cannot take in one go.
+    auto maxBlockSize = (size_t)activeEngines->config.maxBlockSize;
+
+    if (fadingEngines != nullptr)
+        maxBlockSize = juce::jmin(maxBlockSize, (size_t)fadingEngines->config.maxBlockSize);
+
+    for (size_t start = begin; start < end; start += maxBlockSize)
+    {
+        const auto length = juce::jmin(maxBlockSize, end - start);
+        auto subBlock = block.getSubBlock(start, length);
+        auto sidechainBlock = sidechain.getNumChannels() > 0 ? sidechain.getSubBlock(start, length) : sidechain;
+
+        processEngines(subBlock, sidechainBlock, lfoPhase + (double)start * lfoIncrement, lfoIncrement);
+    }
+}
+
+void DistortionPluginAudioProcessor::swapInBuiltEngines()
+{
+    // One crossfade at a time: the outgoing set must be gone first.
+    if (fadingEngines != nullptr)
+        return;
+
+    if (auto built = engineBuilder.takeBuilt())
+    {
+        fadingEngines = std::move(activeEngines);
+        activeEngines = std::move(built);
+        fadeSamplesRemaining = fadeLengthSamples;
+    }
+}
+
+void DistortionPluginAudioProcessor::processEngines(juce::dsp::AudioBlock<float>& block, const juce::dsp::AudioBlock<float>& sidechain,
+                                                    double phase, double increment)
+{
+    if (fadingEngines == nullptr || fadeSamplesRemaining == 0)
+    {
+        activeEngines->process(block, phase, increment, sidechain);
+        return;
+    }
+
+    const auto numSamples = block.getNumSamples();
+    const auto numFadeChannels = juce::jmin(block.getNumChannels(), (size_t)fadingEngines->config.numChannels);
+
+    auto fadeBlock = juce::dsp::AudioBlock<float>(fadingEngines->fadeBuffer)
+                         .getSubsetChannelBlock(0, numFadeChannels)
+                         .getSubBlock(0, numSamples);
+
+    fadeBlock.copyFrom(block.getSubsetChannelBlock(0, numFadeChannels));
+    fadingEngines->process(fadeBlock, phase, increment, sidechain);
 
-        engine.processBlock(channelBlock);
+    activeEngines->process(block, phase, increment, sidechain);
+
+    // Linear ramp from the outgoing set to the new one; channels only the
+    // new set has are taken as they are.
+    const auto fadeLength = (float)fadeLengthSamples;
+
+    for (size_t ch = 0; ch < numFadeChannels; ++ch)
+    {
+        auto* out = block.getChannelPointer(ch);
+        const auto* old = fadeBlock.getChannelPointer(ch);
+
+        for (size_t n = 0; n < numSamples; ++n)
+        {
+            auto remaining = juce::jmax(0, fadeSamplesRemaining - (int)n);
+            auto g = 1.f - (float)remaining / fadeLength;
+            out[n] = old[n] + g * (out[n] - old[n]);
+        }
     }
 
-    oversampler->processSamplesDown(block);
+    fadeSamplesRemaining = juce::jmax(0, fadeSamplesRemaining - (int)numSamples);
 }
 
 //==============================================================================
@@ -206,29 +697,30 @@ juce::AudioProcessorEditor* DistortionPluginAudioProcessor::createEditor()
 //==============================================================================
 void DistortionPluginAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+    // The parameter tree, with the MIDI mapping as an extra child element.
+    if (auto xml = apvts.copyState().createXml())
+    {
+        midiLearn.writeTo(*xml);
+        copyXmlToBinary(*xml, destData);
+    }
 }
 
 void DistortionPluginAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
-}
+    auto xml = getXmlFromBinary(data, sizeInBytes);
 
+    if (xml == nullptr || !xml->hasTagName(apvts.state.getType()))
+        return;
 
-DistortionParameters getDistortionParameters(juce::AudioProcessorValueTreeState& apvts)
-{
-    DistortionParameters parameters;
+    midiLearn.readFrom(*xml);
 
-    parameters.gain   = apvts.getRawParameterValue("Gain")->load();
-    parameters.tone   = apvts.getRawParameterValue("Tone")->load();
-    parameters.volume = apvts.getRawParameterValue("Volume")->load();
+    if (auto* mapping = xml->getChildByName(MidiLearn::mappingTag))
+        xml->removeChildElement(mapping, true);
 
-    return parameters;
+    apvts.replaceState(juce::ValueTree::fromXml(*xml));
 }
 
+
 juce::AudioProcessorValueTreeState::ParameterLayout DistortionPluginAudioProcessor::createParameterLayout()
 {
     juce::AudioProcessorValueTreeState::ParameterLayout layout;
@@ -254,6 +746,122 @@ juce::AudioProcessorValueTreeState::ParameterLayout DistortionPluginAudioProcess
             0.5f)
     );
 
+    // Amount of input envelope added to Gain: harder picking, more drive.
+    layout.add(
+        std::make_unique<juce::AudioParameterFloat>("Envelope",
+            "Envelope",
+            juce::NormalisableRange<float>(0.f, 1.f, 0.01f, 1.f),
+            0.f)
+    );
+
+    // Oversampled samples between envelope-driven coefficient updates:
+    // shorter follows the picking more smoothly, longer costs less CPU.
+    layout.add(
+        std::make_unique<juce::AudioParameterChoice>("ControlInterval",
+            "Envelope Control Interval",
+            juce::StringArray{ "8 samples", "16 samples", "32 samples", "64 samples" },
+            1)
+    );
+
+    // Tempo-synced LFO: one cycle per note value, swinging Gain and Tone by up to their depths.
+    layout.add(
+        std::make_unique<juce::AudioParameterChoice>("LfoRate",
+            "LFO Rate",
+            juce::StringArray{ "1/1", "1/2", "1/4", "1/8", "1/16" },
+            2)
+    );
+
+    layout.add(
+        std::make_unique<juce::AudioParameterFloat>("LfoGain",
+            "LFO Gain Depth",
+            juce::NormalisableRange<float>(0.f, 0.5f, 0.01f, 1.f),
+            0.f)
+    );
+
+    layout.add(
+        std::make_unique<juce::AudioParameterFloat>("LfoTone",
+            "LFO Tone Depth",
+            juce::NormalisableRange<float>(0.f, 0.5f, 0.01f, 1.f),
+            0.f)
+    );
+
+    // Amount of sidechain envelope added to Gain, e.g. a drum bus pumping the drive.
+    layout.add(
+        std::make_unique<juce::AudioParameterFloat>("Sidechain",
+            "Sidechain",
+            juce::NormalisableRange<float>(0.f, 1.f, 0.01f, 1.f),
+            0.f)
+    );
+
+    // Tracks 2 and up, used when their buses are enabled.
+    for (int track = 1; track < maxTrackBuses; ++track)
+    {
+        const auto number = juce::String(track + 1);
+        const auto name = "Track " + number + " ";
+
+        layout.add(
+            std::make_unique<juce::AudioParameterFloat>("Gain" + number,
+                name + "Gain",
+                juce::NormalisableRange<float>(0.01f, 0.99f, 0.01f, 1.f),
+                0.5f)
+        );
+
+        layout.add(
+            std::make_unique<juce::AudioParameterFloat>("Tone" + number,
+                name + "Tone",
+                juce::NormalisableRange<float>(0.f, 1.f, 0.01f, 1.f),
+                0.5f)
+        );
+
+        layout.add(
+            std::make_unique<juce::AudioParameterFloat>("Volume" + number,
+                name + "Volume",
+                juce::NormalisableRange<float>(0.f, 1.f, 0.01f, 1.f),
+                0.5f)
+        );
+    }
+
+    // Polynomial swaps the clipping curve for a degree-15 fit behind a limiter,
+    // at the least oversampling that keeps all its harmonics out of the audio
+    // band: 8x up to 48 kHz, down to none at 384 kHz. Freeze runs a fitted filter-table-filter model of the chain
+    // once Gain, Tone and Volume have settled, and Analog while they move or
+    // anything modulates them.
+    layout.add(
+        std::make_unique<juce::AudioParameterChoice>("Mode",
+            "Mode",
+            juce::StringArray{ "Analog", "Polynomial", "Freeze" },
+            0)
+    );
+
+    // Share SIMD lanes with other instances that have this on, at the cost of
+    // one block of latency. Only in Analog Mode, the one curve the lanes have.
+    // Both are checked at the next prepareToPlay, so hosts get no automation
+    // lane for it, and a Mode change while batched waits for it too.
+    layout.add(
+        std::make_unique<juce::AudioParameterBool>("Batching",
+            "Batch Instances",
+            false,
+            juce::AudioParameterBoolAttributes().withAutomatable(false))
+    );
+
+    // Offline renders with blocks of minFftBlockSize or more use the linear-phase
+    // FftOversampler. Off by default until DistortionBenchmarks' oversampler/
+    // sections show it keeping up with the IIR one; read at prepareToPlay.
+    layout.add(
+        std::make_unique<juce::AudioParameterBool>("OfflineFft",
+            "Offline FFT Oversampling",
+            false,
+            juce::AudioParameterBoolAttributes().withAutomatable(false))
+    );
+
+    // Pick a target, then move a controller: the next CC is mapped to it.
+    layout.add(
+        std::make_unique<juce::AudioParameterChoice>("MidiLearn",
+            "MIDI Learn",
+            juce::StringArray{ "Off", "Gain", "Tone", "Volume" },
+            0)
+    );
+
     return layout;
 }
 
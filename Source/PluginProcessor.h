@@ -9,275 +9,17 @@
 #pragma once
 
 #include <JuceHeader.h>
-#include <vector>
+#include <array>
+#include <atomic>
 #include <memory>
 
-
-struct DistortionParameters
-{
-    float gain{   0.5 };
-    float tone{   0.5 };
-    float volume{ 0.5 };
-};
-
-struct AnalogParameters
-{
-    double A{ 0.f }, B{ 0.f }, C{ 0.f };
-    double D{ 0.f }, E{ 0.f }, F{ 0.f };
-};
-
-DistortionParameters getDistortionParameters(juce::AudioProcessorValueTreeState& apvts);
-
-struct Biquad
-{
-
-    float processSample(float x)
-    {
-        float y  = x * b0 + x1 * b1 + x2 * b2;
-              y -= y1 * a1 + y2 * a2;
-
-        x2 = x1;
-        x1 = x;
-
-        y2 = y1;
-        y1 = y;
-
-        return y;
-    }
-
-    void setCoefficients(float B0, float B1, float B2, float A1, float A2)
-    {
-        b0 = B0; b1 = B1; b2 = B2;
-                 a1 = A1; a2 = A2;
-    }
-
-    void reset()
-    {
-        x1 = 0.f; x2 = 0.f;
-        y1 = 0.f; y2 = 0.f;
-    }
-
-private:
-
-    float b0{ 0.f }, b1{ 0.f }, b2{ 0.f };
-    float            a1{ 0.f }, a2{ 0.f };
-    float x1{ 0.f }, x2{ 0.f };
-    float y1{ 0.f }, y2{ 0.f };
-
-
-};
-
-void calculateCoefficients(Biquad& filter, AnalogParameters& p, float sampleRate)
-{
-    double T = 1.0 / sampleRate;
-
-    double b0, b1, b2;
-    double a0, a1, a2;
-
-    double Tsq = T * T;
-
-    b0 = 4 * p.A / Tsq + 2 * p.B / T + p.C;
-    b1 = 2 * p.C - 8 * p.A / Tsq;
-    b2 = p.C + 4 * p.A / Tsq - 2 * p.B / T;
-
-    a0 = 4 * p.D / Tsq + 2 * p.E / T + p.F;
-    a1 = 2 * p.F - 8 * p.D / Tsq;
-    a2 = p.F + 4 * p.D / Tsq - 2 * p.E / T;
-
-    b0 /= a0;
-    b1 /= a0;
-    b2 /= a0;
-
-    a1 /= a0;
-    a2 /= a0;
-
-    filter.setCoefficients((float)b0, (float)b1, (float)b2, (float)a1, (float)a2);
-}
-
-struct DistortionProcessor
-{
-    DistortionProcessor() = default;
-
-    void setParameters(const DistortionParameters& newParams)
-    {
-        params = newParams;
-    }
-
-    void updateParameters(const DistortionParameters& newParams)
-    {
-        if (!juce::approximatelyEqual(newParams.gain, params.gain))
-        {
-            params.gain = newParams.gain;
-            updateOpAmpFilter();
-        }
-
-        params.tone = newParams.tone;
-        params.volume = newParams.volume;
-    }
-
-    float processSample(float inputsSample)
-    {
-        float processedSample = processBJT(inputsSample);
-
-        processedSample = processOpAmp(processedSample);
-
-        processedSample = processClipper(processedSample);
-
-        processedSample = processTone(processedSample);
-
-        float outputSample = processedSample * params.volume;
-
-        return outputSample;
-    }
-
-    void processBlock(juce::dsp::AudioBlock<float>& block)
-    {
-        const auto numCh = block.getNumChannels();
-        const auto numS = block.getNumSamples();
-
-        for (size_t ch = 0; ch < numCh; ++ch)
-        {
-            auto* data = block.getChannelPointer(ch);
-            for (size_t n = 0; n < numS; ++n)
-            {
-                data[n] = processSample(data[n]);
-            }
-        }
-    }
-
-
-    void prepare(double sampleRate_)
-    {
-        sampleRate = sampleRate_;
-
-        bjt.    reset();
-        opamp.  reset();
-        rc.     reset();
-        toneLP. reset();
-        toneHP. reset();
-
-        updateConstFilters();
-        updateOpAmpFilter();
-    }
-    
-
-private:
-    DistortionParameters params;
-    Biquad bjt, opamp, rc, toneLP, toneHP;
-    AnalogParameters bjtParams, opampParams, rcParams, toneLpParams, toneHpParams;
-
-    const float bjtGain = std::pow(10, 42.f/20.f);
-    const float aDiode = 0.405;
-    const float bDiode = 3.178;
-    const float pi = 3.14159265359f;
-
-    float sampleRate;
-
-    float processBJT(float x)
-    {
-        float y = bjt.processSample(x);
-        return bjtGain * y;
-    }
-
-    float processOpAmp(float x)
-    {
-        float y = opamp.processSample(x);
-
-        y = y > 0 ? 4.55 * std::tanh(y / 4.55) : 4.4 * std::tanh(y / 4.4);
-
-        return y;
-    }
-
-    float processClipper(float x)
-    {
-        float xClipped = aDiode * std::atan(x * bDiode);
-
-        float y = rc.processSample(xClipped);
-
-        return y;
-    }
-
-    float processTone(float x)
-    {
-        float xLP = toneLP.processSample(x);
-        float xHP = toneHP.processSample(x);
-        float y = (1 - params.tone) * xLP + params.tone * xHP;
-
-        return y;
-    }
-
-    void updateConstFilters()
-    {   
-        // BJT stage
-        double w1 = 2 * pi * 3.f;
-        double w2 = 2 * pi * 600.f;
-        bjtParams.A = 1.f;
-        bjtParams.B = 0.f;
-        bjtParams.C = 0.f;
-        bjtParams.D = 1.f;
-        bjtParams.E = w1 + w2;
-        bjtParams.F = w1 * w2;
-
-        calculateCoefficients(bjt, bjtParams, sampleRate);
-
-        // RC stage
-
-        double R = 2.2e3;
-        double C = 0.01e-6;
-
-        rcParams.C = 1.f;
-        rcParams.E = R * C;
-        rcParams.F = 1.f;
-
-        calculateCoefficients(rc, rcParams, sampleRate);
-
-        // Tone stage
-
-        double LpR    = 6.8e3;
-        double LpC    = 0.1e-6;
-        double hpR1   = 2.2e3;
-        double hpR2   = 6.8e3;
-        double hpC    = 0.022e-6;
-        double lpF    = 320.f;
-        double hpF    = 1.16e3;
-        double hpGain = hpR2 / (hpR1 + hpR2);
-
-        toneLpParams.C = 1.f;
-        toneLpParams.E = 1.f / (2.f * pi * lpF);
-        toneLpParams.F = 1.f;
-
-        toneHpParams.B = hpGain;
-        toneHpParams.E = 1.f;
-        toneHpParams.F = 2.f * pi * hpF;
-
-        calculateCoefficients(toneLP, toneLpParams, sampleRate);
-        calculateCoefficients(toneHP, toneHpParams, sampleRate);
-
-    }
-
-    void updateOpAmpFilter()
-    {
-        float dist = params.gain;
-
-        double Rt = (double)dist * 100e3;
-        double Rb = (1.f - (double)dist) * 100e3 + 4.7e3;
-        double Cz = 1e-6;
-        double Cc = 250e-12;
-        double a = 1 / (Rt * Cc);
-        double b = 1 / (Rb * Cz);
-        double c = 1 / (Rb * Cc);
-
-        opampParams.A = 1.f;
-        opampParams.B = a + b + c;
-        opampParams.C = a * b;
-        opampParams.D = 1.f;
-        opampParams.E = a + b;
-        opampParams.F = a * b;
-
-        calculateCoefficients(opamp, opampParams, sampleRate);
-    }
-};
-
+#include "PerfCounters.h"
+#include "MidiLearn.h"
+#include "WorkerPool.h"
+#include "DistortionProcessor.h"
+#include "FreezeModel.h"
+#include "EngineSet.h"
+#include "InstanceBatcher.h"
 
 
 //==============================================================================
@@ -325,12 +67,125 @@ public:
 
     static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
 
+    // Track 1 is the main bus; tracks 2 and up are optional stereo bus pairs
+    // with their own Gain, Tone and Volume, run together through one oversampler.
+    static constexpr int maxTrackBuses = 8;
+
+    // Sample buffers and engines the processor holds on the heap while
+    // prepared; zero after releaseResources.
+    size_t getEngineMemoryBytes() const;
+
+    // Error and CPU saving of the latest Freeze mode fit, both measured on a
+    // single synthetic pluck; the -30 dB error threshold is judged on it alone.
+    FreezeFitter::Report getFreezeReport() const;
+
     juce::AudioProcessorValueTreeState apvts{*this, nullptr, "Parameters", createParameterLayout()};
 
 private:
+    // Looked up once, so reading parameters costs nothing per block even at 32 samples.
+    std::atomic<float>* gainParameter   = apvts.getRawParameterValue("Gain");
+    std::atomic<float>* toneParameter   = apvts.getRawParameterValue("Tone");
+    std::atomic<float>* volumeParameter = apvts.getRawParameterValue("Volume");
+    std::atomic<float>* envelopeParameter        = apvts.getRawParameterValue("Envelope");
+    std::atomic<float>* controlIntervalParameter = apvts.getRawParameterValue("ControlInterval");
+    std::atomic<float>* lfoRateParameter         = apvts.getRawParameterValue("LfoRate");
+    std::atomic<float>* lfoGainParameter         = apvts.getRawParameterValue("LfoGain");
+    std::atomic<float>* lfoToneParameter         = apvts.getRawParameterValue("LfoTone");
+    std::atomic<float>* sidechainParameter       = apvts.getRawParameterValue("Sidechain");
+    std::atomic<float>* batchingParameter        = apvts.getRawParameterValue("Batching");
+    std::atomic<float>* modeParameter            = apvts.getRawParameterValue("Mode");
+    std::atomic<float>* offlineFftParameter      = apvts.getRawParameterValue("OfflineFft");
+
+    // Gain, Tone and Volume of tracks 2 and up; index 0 stays empty.
+    struct TrackParameters
+    {
+        std::atomic<float>* gain   = nullptr;
+        std::atomic<float>* tone   = nullptr;
+        std::atomic<float>* volume = nullptr;
+    };
+
+    std::array<TrackParameters, maxTrackBuses> trackParameters;
+
+    // Choices of the Mode parameter.
+    enum Mode
+    {
+        analogMode,
+        polynomialMode,
+        freezeMode
+    };
+
+    MidiLearn midiLearn{ apvts };
+
+    DistortionParameters loadParameters() const;
+    DistortionParameters loadTrackParameters(int track) const;
+    void processRange(juce::dsp::AudioBlock<float>& block, juce::dsp::AudioBlock<float>& sidechain,
+                      size_t begin, size_t end, double lfoIncrement);
+
+    static constexpr int maxOversamplingStages = 3;
+    static constexpr double maxOversampledRate = 384000.0;
+
+    // Offline blocks from this size up may use FftOversampler, a little over one of its hops.
+    static constexpr int minFftBlockSize = 1024;
+
+    EngineConfig createEngineConfig(double sampleRate, int samplesPerBlock) const;
+    void setOfflineOptions(EngineConfig& config) const;
+
+    static int getOversamplingStages(double sampleRate, bool polynomial = false);
+    static int getOversamplerLatency(int stages);
+
+    static BusesProperties createBusesProperties();
+    static int getTrackInputBus(int track)  { return track == 0 ? 0 : track + 1; }
+    static int getTrackOutputBus(int track) { return track; }
+
+    void swapInBuiltEngines();
+    void processEngines(juce::dsp::AudioBlock<float>& block, const juce::dsp::AudioBlock<float>& sidechain,
+                        double phase, double increment);
+
+    // Free-running LFO state, used while the host is stopped or has no play head.
+    double lfoPhase{ 0.0 };
+    double lfoTempo{ 120.0 };
+
     DistortionProcessor distortionProcessor;
-    std::array<DistortionProcessor, 2> distortionEngine;
-    std::unique_ptr<juce::dsp::Oversampling<float>> oversampler;
+
+    // Owned by the audio thread. While fadingEngines is set, its output is
+    // crossfaded into that of activeEngines over fadeSamplesRemaining samples.
+    std::unique_ptr<EngineSet> activeEngines;
+    std::unique_ptr<EngineSet> fadingEngines;
+    int fadeLengthSamples{ 0 };
+    int fadeSamplesRemaining{ 0 };
+    EngineConfig lastRequestedConfig;
+
+    EngineBuilder engineBuilder;
+
+    // Shared with the builders and fitters, which queue their jobs on it.
+    juce::SharedResourcePointer<WorkerPool> workerPool;
+
+    // Freeze mode: the audio thread's copy of the latest fitted model, which
+    // the engine sets run while it matches the parameters.
+    FreezeFitter freezeFitter;
+    FreezeModel freezeModel;
+
+    // Set by prepareToPlay when any track bus besides the main one is
+    // enabled; processBlock then runs tracks 2 and up through it, after the
+    // main track.
+    std::unique_ptr<MultiBusEngineSet> multiBusEngines;
+    std::array<int, maxTrackBuses> trackFirstLane{}, trackNumLanes{};
+
+    void processMultiBus(juce::AudioBuffer<float>& buffer);
+
+    // Set by prepareToPlay when Batching is on in Analog Mode and the batcher
+    // took this instance; processBlock then runs the main bus through it instead.
+    std::unique_ptr<BatchedEngine> batchedEngine;
+
+    void processBatched(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages);
+
+    // For the batched engine, which takes mapped CCs at the start of the block.
+    void handleControllers(const juce::MidiBuffer& midiMessages);
+
+   #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+    PerfSection* blockPerfSection = nullptr;
+    PerfSection* parameterPerfSection = nullptr;
+   #endif
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DistortionPluginAudioProcessor)
 };
@@ -0,0 +1,186 @@
+/*
+  ==============================================================================
+
+    Standalone application, replacing JUCE's default one
+    (JUCE_USE_CUSTOM_PLUGIN_STANDALONE_APP=1).
+
+    Without arguments it behaves like the stock standalone window. Started with
+    --headless it opens no window at all, for stage boxes without a screen:
+    the audio device settings are taken from the saved standalone settings.
+
+    In both modes parameters can be set with plain-text UDP datagrams sent to
+    127.0.0.1 (port 9001, or --port <n>), one change per datagram:
+
+        /gain 0.7
+        tone 0.25
+
+    The socket only listens on the loopback interface. Values are in the
+    parameter's own range and are applied through the parameter objects, so
+    the audio thread only ever sees the lock-free atomics.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+
+#if JucePlugin_Build_Standalone && JUCE_USE_CUSTOM_PLUGIN_STANDALONE_APP
+
+#include <juce_audio_plugin_client/Standalone/juce_StandaloneFilterWindow.h>
+
+//==============================================================================
+class ParameterControlServer  : private juce::Thread
+{
+public:
+    ParameterControlServer(juce::AudioProcessor& p, int portNumber)
+        : juce::Thread("Parameter control server"), processor(p), port(portNumber)
+    {
+        if (socket.bindToPort(port, "127.0.0.1"))
+            startThread(juce::Thread::Priority::low);
+        else
+            juce::Logger::writeToLog("Could not listen on 127.0.0.1:" + juce::String(port));
+    }
+
+    ~ParameterControlServer() override
+    {
+        signalThreadShouldExit();
+        socket.shutdown();
+        stopThread(1000);
+    }
+
+private:
+    void run() override
+    {
+        char data[256];
+
+        while (!threadShouldExit())
+        {
+            if (socket.waitUntilReady(true, 100) != 1)
+                continue;
+
+            auto numBytes = socket.read(data, (int)sizeof(data) - 1, false);
+
+            if (numBytes > 0)
+                handleMessage(juce::String::fromUTF8(data, numBytes));
+        }
+    }
+
+    void handleMessage(const juce::String& message)
+    {
+        auto text = message.trim();
+
+        if (text.startsWith("/"))
+            text = text.substring(1);
+
+        auto name  = text.upToFirstOccurrenceOf(" ", false, false);
+        auto value = text.fromFirstOccurrenceOf(" ", false, false).trim();
+
+        if (name.isEmpty() || value.isEmpty())
+            return;
+
+        for (auto* parameter : processor.getParameters())
+        {
+            auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter);
+
+            if (ranged != nullptr && ranged->getParameterID().equalsIgnoreCase(name))
+            {
+                ranged->setValueNotifyingHost(ranged->convertTo0to1(value.getFloatValue()));
+                return;
+            }
+        }
+    }
+
+    juce::AudioProcessor& processor;
+    const int port;
+    juce::DatagramSocket socket{ false };
+
+    JUCE_DECLARE_NON_COPYABLE(ParameterControlServer)
+};
+
+//==============================================================================
+class DistortionStandaloneApp  : public juce::JUCEApplication
+{
+public:
+    DistortionStandaloneApp()
+    {
+        juce::PropertiesFile::Options options;
+
+        options.applicationName     = juce::CharPointer_UTF8(JucePlugin_Name);
+        options.filenameSuffix      = ".settings";
+        options.osxLibrarySubFolder = "Application Support";
+       #if JUCE_LINUX || JUCE_BSD
+        options.folderName          = "~/.config";
+       #else
+        options.folderName          = "";
+       #endif
+
+        appProperties.setStorageParameters(options);
+    }
+
+    const juce::String getApplicationName() override    { return juce::CharPointer_UTF8(JucePlugin_Name); }
+    const juce::String getApplicationVersion() override { return JucePlugin_VersionString; }
+    bool moreThanOneInstanceAllowed() override          { return true; }
+    void anotherInstanceStarted(const juce::String&) override {}
+
+    void initialise(const juce::String&) override
+    {
+        auto args = getCommandLineParameterArray();
+        auto portIndex = args.indexOf("--port");
+        auto port = portIndex >= 0 && portIndex + 1 < args.size() ? args[portIndex + 1].getIntValue() : defaultPort;
+
+        juce::AudioProcessor* processor = nullptr;
+
+        if (args.contains("--headless"))
+        {
+            pluginHolder = std::make_unique<juce::StandalonePluginHolder>(appProperties.getUserSettings(),
+                                                                          false, juce::String{}, nullptr,
+                                                                          juce::Array<juce::StandalonePluginHolder::PluginInOuts>{},
+                                                                          false);
+            processor = pluginHolder->processor.get();
+        }
+        else
+        {
+            mainWindow = std::make_unique<juce::StandaloneFilterWindow>(getApplicationName(),
+                                                                        juce::LookAndFeel::getDefaultLookAndFeel()
+                                                                            .findColour(juce::ResizableWindow::backgroundColourId),
+                                                                        appProperties.getUserSettings(),
+                                                                        false);
+            mainWindow->setVisible(true);
+            processor = mainWindow->getPluginHolder()->processor.get();
+        }
+
+        if (processor != nullptr)
+            controlServer = std::make_unique<ParameterControlServer>(*processor, port);
+    }
+
+    void shutdown() override
+    {
+        controlServer = nullptr;
+
+        if (pluginHolder != nullptr)
+            pluginHolder->savePluginState();
+
+        if (mainWindow != nullptr)
+            mainWindow->getPluginHolder()->savePluginState();
+
+        pluginHolder = nullptr;
+        mainWindow = nullptr;
+        appProperties.saveIfNeeded();
+    }
+
+    void systemRequestedQuit() override
+    {
+        quit();
+    }
+
+private:
+    static constexpr int defaultPort = 9001;
+
+    juce::ApplicationProperties appProperties;
+    std::unique_ptr<juce::StandaloneFilterWindow> mainWindow;
+    std::unique_ptr<juce::StandalonePluginHolder> pluginHolder;
+    std::unique_ptr<ParameterControlServer> controlServer;
+};
+
+JUCE_CREATE_APPLICATION_DEFINE(DistortionStandaloneApp)
+
+#endif
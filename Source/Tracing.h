@@ -0,0 +1,33 @@
+/*
+  ==============================================================================
+
+    USDT (static tracepoint) markers for profiling on Linux.
+
+    The probes are emitted whenever <sys/sdt.h> is available
+    (systemtap-sdt-dev), so a release build can be traced as it is. Each probe
+    is a single nop until a tracer attaches. Build with
+    DISTORTION_ENABLE_USDT=0 to leave them out; elsewhere the macros expand to
+    nothing.
+
+    e.g.  perf probe -x distortionPlugin.so sdt_distortionPlugin:engine__start
+          bpftrace -e 'usdt:distortionPlugin.so:distortionPlugin:engine__done { @[tid] = count(); }'
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#if defined (__linux__) && defined (__has_include)
+ #if __has_include(<sys/sdt.h>) && ! defined (DISTORTION_ENABLE_USDT)
+  #define DISTORTION_ENABLE_USDT 1
+ #endif
+#endif
+
+#if defined (DISTORTION_ENABLE_USDT) && DISTORTION_ENABLE_USDT && defined (__linux__)
+ #include <sys/sdt.h>
+ #define DISTORTION_PROBE(name)          DTRACE_PROBE  (distortionPlugin, name)
+ #define DISTORTION_PROBE1(name, arg1)   DTRACE_PROBE1 (distortionPlugin, name, arg1)
+#else
+ #define DISTORTION_PROBE(name)
+ #define DISTORTION_PROBE1(name, arg1)
+#endif
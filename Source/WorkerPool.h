@@ -0,0 +1,299 @@
+/*
+  ==============================================================================
+
+    One set of background threads for every instance in the process, shared
+    through juce::SharedResourcePointer, so 200 instances do not mean 200
+    threads. The threads start with the first job, not when the host creates
+    instances to scan them.
+
+    Jobs are objects owned by their clients, queued at one of three
+    priorities in fixed-size queues. Adding one never allocates or blocks,
+    so the audio thread may add jobs. A job added while it runs runs once
+    more afterwards, never on two workers at once.
+
+    Idle workers sleep until woken. Adding a job only tries the wake-up
+    lock; if a worker happens to hold it, the wake-up is left to the next
+    addJob, to wakeIfPending(), which the audio thread calls once per block,
+    or to the pool's timer on the message thread, which comes round whether
+    or not the host calls processBlock.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class WorkerPool  : private juce::Timer
+{
+public:
+    enum Priority
+    {
+        high,
+        normal,
+        low,
+        numPriorities
+    };
+
+    static constexpr int queueSize = 64;
+
+    class Job
+    {
+    public:
+        explicit Job(std::function<void()> work) : run(std::move(work)) {}
+
+    private:
+        friend class WorkerPool;
+
+        const std::function<void()> run;
+        std::atomic<bool> queued{ false };
+        std::atomic<bool> running{ false };
+
+        JUCE_DECLARE_NON_COPYABLE(Job)
+    };
+
+    WorkerPool() = default;
+
+    ~WorkerPool() override
+    {
+        stopTimer();
+
+        for (auto& worker : workers)
+            worker->signalThreadShouldExit();
+
+        {
+            const std::lock_guard<std::mutex> lock(wakeMutex);
+            wakeRequested.store(true);
+        }
+
+        wakeCondition.notify_all();
+
+        for (auto& worker : workers)
+            worker->stopThread(2000);
+    }
+
+    void start()
+    {
+        const juce::ScopedLock sl(startLock);
+
+        if (!workers.empty())
+            return;
+
+        const auto numWorkers = juce::jlimit(1, maxWorkers, juce::SystemStats::getNumCpus() / 2);
+
+        for (int i = 0; i < numWorkers; ++i)
+        {
+            workers.push_back(std::make_unique<Worker>(*this, i));
+            workers.back()->startThread(juce::Thread::Priority::low);
+        }
+
+        startTimerHz(retryRateHz);
+    }
+
+    // Queues job unless it is queued already, and wakes a worker. Fails
+    // while its queue is full or another thread holds the lock; try again
+    // later. Jobs added before start() wait for it.
+    bool addJob(Job& job, Priority priority)
+    {
+        if (job.queued.load())
+        {
+            wake(false);
+            return true;
+        }
+
+        {
+            const juce::SpinLock::ScopedTryLockType lock(queueLock);
+
+            if (!lock.isLocked())
+                return false;
+
+            auto& queue = queues[(size_t)priority];
+
+            if (job.queued.load())
+                return true;
+
+            if (queue.count == queueSize)
+                return false;
+
+            job.queued.store(true);
+            queue.jobs[(size_t)((queue.head + queue.count) % queueSize)] = &job;
+            ++queue.count;
+            ++numQueued;
+        }
+
+        wake(false);
+        return true;
+    }
+
+    // Never blocks. Retries a wake-up that addJob could not deliver, if any
+    // job is still queued.
+    void wakeIfPending()
+    {
+        if (numQueued.load() > 0)
+            wake(false);
+    }
+
+    // For a job's owner before it goes away: dequeues the job and waits
+    // until no worker runs it any more.
+    void removeJob(Job& job)
+    {
+        {
+            const juce::SpinLock::ScopedLockType lock(queueLock);
+
+            for (auto& queue : queues)
+            {
+                int kept = 0;
+
+                for (int i = 0; i < queue.count; ++i)
+                {
+                    auto* queued = queue.jobs[(size_t)((queue.head + i) % queueSize)];
+
+                    if (queued != &job)
+                        queue.jobs[(size_t)((queue.head + kept++) % queueSize)] = queued;
+                }
+
+                numQueued -= queue.count - kept;
+                queue.count = kept;
+            }
+
+            job.queued.store(false);
+        }
+
+        const juce::ScopedLock sl(startLock);
+
+        for (auto& worker : workers)
+            while (worker->current.load() == &job)
+                juce::Thread::sleep(1);
+    }
+
+private:
+    static constexpr int maxWorkers = 4;
+    static constexpr int retryRateHz = 10;
+
+    class Worker  : public juce::Thread
+    {
+    public:
+        Worker(WorkerPool& p, int index)
+            : juce::Thread("Distortion worker " + juce::String(index + 1)), pool(p) {}
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                if (auto* job = pool.takeNextJob(*this))
+                {
+                    // Another worker for whatever else is queued.
+                    if (pool.numQueued.load() > 0)
+                        pool.wake(true);
+
+                    job->run();
+
+                    // Before current: removeJob lets the owner delete the
+                    // job once no worker has it as current.
+                    job->running.store(false);
+                    current.store(nullptr);
+                }
+                else
+                {
+                    std::unique_lock<std::mutex> lock(pool.wakeMutex);
+                    pool.wakeCondition.wait(lock, [this] { return pool.wakeRequested.exchange(false) || threadShouldExit(); });
+                }
+            }
+        }
+
+        std::atomic<Job*> current{ nullptr };
+
+    private:
+        WorkerPool& pool;
+    };
+
+    // Highest priority first, oldest first within a priority, skipping jobs
+    // that still run on another worker. Marks the job as the worker's
+    // current one before the lock is released, so that removeJob cannot
+    // miss it.
+    Job* takeNextJob(Worker& worker)
+    {
+        const juce::SpinLock::ScopedLockType lock(queueLock);
+
+        for (auto& queue : queues)
+        {
+            for (int i = 0; i < queue.count; ++i)
+            {
+                auto* job = queue.jobs[(size_t)((queue.head + i) % queueSize)];
+
+                if (job->running.load())
+                    continue;
+
+                for (int j = i; j > 0; --j)
+                    queue.jobs[(size_t)((queue.head + j) % queueSize)] = queue.jobs[(size_t)((queue.head + j - 1) % queueSize)];
+
+                queue.head = (queue.head + 1) % queueSize;
+                --queue.count;
+
+                job->running.store(true);
+                worker.current.store(job);
+                job->queued.store(false);
+                --numQueued;
+
+                return job;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Delivers any wake-up that addJob had to skip.
+    void timerCallback() override
+    {
+        if (numQueued.load() > 0)
+            wake(true);
+    }
+
+    struct Queue
+    {
+        std::array<Job*, queueSize> jobs{};
+        int head{ 0 };
+        int count{ 0 };
+    };
+
+    juce::SpinLock queueLock;
+    std::array<Queue, numPriorities> queues;
+    std::atomic<int> numQueued{ 0 };
+
+    // Sets wakeRequested and wakes one worker. Without mayBlock, as on the
+    // audio thread, the notification is skipped while anyone else holds the
+    // mutex, which is only ever for a moment; wakeRequested stays set and the
+    // next wake(), at the latest from timerCallback, delivers it.
+    void wake(bool mayBlock)
+    {
+        wakeRequested.store(true);
+
+        if (mayBlock)
+        {
+            wakeMutex.lock();
+        }
+        else if (!wakeMutex.try_lock())
+        {
+            return;
+        }
+
+        wakeMutex.unlock();
+        wakeCondition.notify_one();
+    }
+
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<bool> wakeRequested{ false };
+
+    juce::CriticalSection startLock;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    JUCE_DECLARE_NON_COPYABLE(WorkerPool)
+};
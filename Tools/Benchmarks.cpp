@@ -0,0 +1,180 @@
+/*
+  ==============================================================================
+
+    Benchmarks of the processor outside any host, built with
+    DISTORTION_ENABLE_PERF_COUNTERS=1 (see Tools/CMakeLists.txt). The results
+    go through PerfRegistry like those of an instrumented plugin build.
+
+        DistortionBenchmarks [--output <json>] [--baseline <json>]
+                             [--threshold <percent>] [--hw]
+
+    --output writes the results as JSON, --baseline compares them with an
+    earlier --output and exits with 1 when any section got slower by more
+    than --threshold percent (default 10). --hw reads hardware counters
+    around the kernel benchmarks, on Linux.
+
+    scenario/gainAutomation/<block size>: Gain moves on every block, as a
+    host automating it sends, so every block recomputes the op-amp
+    coefficients. Stereo noise at 48 kHz in blocks of 32 to 1024 samples,
+    ten seconds each after one of warm-up.
+
+    chain/<mode>/x<factor>: a complete engine set, oversampler included, at
+    every oversampling factor, on 512-sample blocks of stereo noise at 48 kHz.
+
+    kernel/..., oversampler/...: the single stages, at every factor; see
+    DistortionProcessor::runKernelBenchmarks and FftOversampler::runBenchmarks.
+
+    postFilter/...: the RC and tone biquads against PostFilterConvolver, an
+    FFT convolution experiment kept here rather than in the plugin.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "PostFilterConvolver.h"
+
+namespace
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int maxStages = 3;
+
+    void fillWithNoise(juce::AudioBuffer<float>& buffer, juce::Random& random)
+    {
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            for (int n = 0; n < buffer.getNumSamples(); ++n)
+                buffer.setSample(ch, n, 0.5f * random.nextFloat() - 0.25f);
+    }
+
+    void runGainAutomation(int blockSize)
+    {
+        DistortionPluginAudioProcessor processor;
+        processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        auto* gain = processor.apvts.getParameter("Gain");
+
+        juce::AudioBuffer<float> buffer(juce::jmax(processor.getTotalNumInputChannels(),
+                                                   processor.getTotalNumOutputChannels()), blockSize);
+        juce::MidiBuffer midiMessages;
+        juce::Random random(1);
+
+        auto& section = PerfRegistry::getInstance().getSection("scenario/gainAutomation/" + juce::String(blockSize));
+
+        const auto numWarmUpBlocks = (int)sampleRate / blockSize;
+        const auto numBlocks = numWarmUpBlocks * 10;
+
+        for (int block = 0; block < numWarmUpBlocks + numBlocks; ++block)
+        {
+            fillWithNoise(buffer, random);
+
+            // A slow sweep with a new value every block.
+            gain->setValueNotifyingHost(0.5f + 0.45f * std::sin(0.01f * (float)block));
+
+            const ScopedPerfMeasurement measurement(block >= numWarmUpBlocks ? &section : nullptr);
+            processor.processBlock(buffer, midiMessages);
+        }
+
+        processor.releaseResources();
+    }
+
+    void runChain(int stages, bool polynomial, HardwareCounters* hardwareCounters)
+    {
+        constexpr int blockSize = 512;
+        constexpr int numRuns = 256;
+
+        EngineConfig config;
+        config.sampleRate         = sampleRate;
+        config.numChannels        = 2;
+        config.oversamplingStages = stages;
+        config.maxBlockSize       = blockSize;
+        config.polynomial         = polynomial;
+
+        EngineSet set(config);
+        set.updateParameters({});
+
+        const auto factor = set.getOversamplingFactor();
+        auto& section = PerfRegistry::getInstance().getSection(juce::String("chain/") + (polynomial ? "polynomial" : "analog")
+                                                               + "/x" + juce::String(factor));
+
+        juce::AudioBuffer<float> buffer(config.numChannels, blockSize);
+        juce::Random random(0x5eed);
+
+        for (int r = 0; r < numRuns; ++r)
+        {
+            fillWithNoise(buffer, random);
+            juce::dsp::AudioBlock<float> block(buffer);
+
+            const ScopedPerfMeasurement measurement(r >= numRuns / 8 ? &section : nullptr, hardwareCounters);
+            set.process(block);
+        }
+
+        // The single stages of the same chain.
+        if (!polynomial)
+            set.engines[0].runKernelBenchmarks(factor, hardwareCounters);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // The parameters post their changes to the message thread.
+    const juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::StringArray args;
+
+    for (int i = 1; i < argc; ++i)
+        args.add(argv[i]);
+
+    auto getOption = [&args](const juce::String& name, const juce::String& defaultValue)
+    {
+        auto index = args.indexOf(name);
+        return index >= 0 && index + 1 < args.size() ? args[index + 1] : defaultValue;
+    };
+
+    HardwareCounters counters;
+    auto* hardwareCounters = args.contains("--hw") && counters.isValid() ? &counters : nullptr;
+
+    if (args.contains("--hw") && hardwareCounters == nullptr)
+        std::cerr << "No hardware counters on this system, timing only" << std::endl;
+
+    // Held across all scenarios, so the summary is logged once at the end.
+    auto& registry = PerfRegistry::getInstance();
+    registry.addClient();
+
+    for (auto blockSize : { 32, 64, 128, 256, 512, 1024 })
+        runGainAutomation(blockSize);
+
+    for (int stages = 0; stages <= maxStages; ++stages)
+        runChain(stages, false, hardwareCounters);
+
+    runChain(PolynomialShaper::getOversamplingStages(sampleRate), true, hardwareCounters);
+
+    for (int stages = 1; stages <= maxStages; ++stages)
+        FftOversampler::runBenchmarks(stages, 1024);
+
+    // The convolver only replaces the biquads at the highest internal rates.
+    for (auto rate : { 352800.0, 384000.0 })
+        PostFilterConvolver::runBenchmarks(rate, 8192);
+
+    registry.removeClient();
+
+    auto outputPath = getOption("--output", {});
+
+    if (outputPath.isNotEmpty() && !registry.writeJson(juce::File::getCurrentWorkingDirectory().getChildFile(outputPath)))
+    {
+        std::cerr << "Could not write " << outputPath << std::endl;
+        return 1;
+    }
+
+    auto baselinePath = getOption("--baseline", {});
+
+    if (baselinePath.isNotEmpty())
+    {
+        auto threshold = getOption("--threshold", "10").getDoubleValue();
+
+        if (registry.compareWithBaseline(juce::File::getCurrentWorkingDirectory().getChildFile(baselinePath), threshold) > 0)
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+  ==============================================================================
+
+    Noise floor of the constant filters at the highest internal rates, where
+    their poles sit closest to z = 1, against the same filters run in long
+    double.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+namespace
+{
+    // DF1 with coefficients worked out from the analog prototype in long double.
+    struct ReferenceBiquad
+    {
+        ReferenceBiquad(const AnalogParameters& p, double sampleRate)
+        {
+            const long double T = 1.0L / (long double)sampleRate, Tsq = T * T;
+
+            const long double a0 = 4 * p.D / Tsq + 2 * p.E / T + p.F;
+            b0 = (4 * p.A / Tsq + 2 * p.B / T + p.C) / a0;
+            b1 = (2 * p.C - 8 * p.A / Tsq) / a0;
+            b2 = (p.C + 4 * p.A / Tsq - 2 * p.B / T) / a0;
+            a1 = (2 * p.F - 8 * p.D / Tsq) / a0;
+            a2 = (p.F + 4 * p.D / Tsq - 2 * p.E / T) / a0;
+        }
+
+        long double processSample(long double x)
+        {
+            long double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+            x2 = x1; x1 = x;
+            y2 = y1; y1 = y;
+            return y;
+        }
+
+        long double b0, b1, b2, a1, a2;
+        long double x1{ 0 }, x2{ 0 }, y1{ 0 }, y2{ 0 };
+    };
+}
+
+class BiquadPrecisionTest : public juce::UnitTest
+{
+public:
+    BiquadPrecisionTest() : juce::UnitTest("Biquad precision", "Distortion") {}
+
+    void runTest() override
+    {
+        AnalogParameters bjt, rc, toneLP, toneHP;
+        DistortionProcessor::getConstFilterParameters(bjt, rc, toneLP, toneHP);
+
+        // 8x 48 kHz and 8x 192 kHz.
+        for (auto sampleRate : { 384000.0, 1536000.0 })
+        {
+            beginTest("Precision picked at " + juce::String(sampleRate / 1000.0) + " kHz");
+
+            Biquad bjtFilter, rcFilter, toneLpFilter, toneHpFilter;
+            calculateCoefficients(bjtFilter,    bjt,    (float)sampleRate);
+            calculateCoefficients(rcFilter,     rc,     (float)sampleRate);
+            calculateCoefficients(toneLpFilter, toneLP, (float)sampleRate);
+            calculateCoefficients(toneHpFilter, toneHP, (float)sampleRate);
+
+            expect(bjtFilter.isHighPrecision(), "the BJT filter's poles are next to z = 1");
+            expect(!rcFilter.isHighPrecision() && !toneLpFilter.isHighPrecision() && !toneHpFilter.isHighPrecision(),
+                   "the RC and tone filters should stay in float");
+
+            beginTest("BJT noise floor at " + juce::String(sampleRate / 1000.0) + " kHz");
+
+            for (bool block : { false, true })
+            {
+                auto snr = measureSnr(bjt, sampleRate, block);
+                logMessage(juce::String(block ? "processBlock" : "processSample") + ": " + juce::String(snr, 1) + " dB SNR");
+                expectGreaterThan(snr, minSnrDb);
+            }
+        }
+    }
+
+private:
+    // Float alone gets ~54 dB at 8x 48 kHz and ~20 dB at 8x 192 kHz.
+    static constexpr double minSnrDb = 130.0;
+
+    // A 200 Hz tone plus a little noise for one second; the first half, where
+    // the 3 Hz corner is still settling, is left out.
+    static double measureSnr(const AnalogParameters& params, double sampleRate, bool block)
+    {
+        Biquad filter;
+        calculateCoefficients(filter, params, (float)sampleRate);
+        ReferenceBiquad reference(params, sampleRate);
+
+        const auto numSamples = (int)sampleRate;
+        std::vector<float> input((size_t)numSamples);
+        juce::Random random(1);
+
+        for (int n = 0; n < numSamples; ++n)
+            input[(size_t)n] = 0.5f * (float)std::sin(juce::MathConstants<double>::twoPi * 200.0 * n / sampleRate)
+                             + 0.01f * (2.f * random.nextFloat() - 1.f);
+
+        auto output = input;
+
+        if (block)
+            filter.processBlock(output.data(), numSamples);
+        else
+            for (auto& x : output)
+                x = filter.processSample(x);
+
+        long double signal = 0, noise = 0;
+
+        for (int n = 0; n < numSamples; ++n)
+        {
+            auto y = reference.processSample(input[(size_t)n]);
+
+            if (n >= numSamples / 2)
+            {
+                signal += y * y;
+                noise  += (output[(size_t)n] - y) * (output[(size_t)n] - y);
+            }
+        }
+
+        return 10.0 * std::log10((double)(signal / juce::jmax(noise, 1.0e-30L)));
+    }
+};
+
+static BiquadPrecisionTest biquadPrecisionTest;
@@ -0,0 +1,179 @@
+/*
+  ==============================================================================
+
+    The FFT stages against what they promise: FftOversampler's round trip
+    delays by exactly its reported latency, and PostFilterConvolver stays
+    within its error bound of the RC and tone filters run in double.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "FftOversampler.h"
+#include "PostFilterConvolver.h"
+
+//==============================================================================
+class FftOversamplerTest : public juce::UnitTest
+{
+public:
+    FftOversamplerTest() : juce::UnitTest("FFT oversampler latency", "Distortion") {}
+
+    void runTest() override
+    {
+        for (int stages = 1; stages <= 3; ++stages)
+        {
+            beginTest(juce::String(1 << stages) + "x round trip");
+
+            // An impulse comes out where the latency says, and nowhere else.
+            auto impulse = roundTrip(stages, [](int n) { return n == impulsePosition ? 1.f : 0.f; });
+            auto peak = (int)std::distance(impulse.begin(), std::max_element(impulse.begin(), impulse.end(),
+                                                                              [](float a, float b) { return std::abs(a) < std::abs(b); }));
+            expectEquals(peak, impulsePosition + FftOversampler::latencySamples);
+
+            // A passband tone comes out the same, that much later.
+            auto tone = [](int n) { return 0.5f * (float)std::sin(juce::MathConstants<double>::twoPi * 0.1 * n); };
+            auto output = roundTrip(stages, tone);
+            float maxError = 0.f;
+
+            for (int n = FftOversampler::latencySamples + FftOversampler::baseFftSize; n < numSamples; ++n)
+                maxError = juce::jmax(maxError, std::abs(output[(size_t)n] - tone(n - FftOversampler::latencySamples)));
+
+            logMessage("  tone error " + juce::String(maxError));
+            expectLessThan(maxError, 1.0e-4f);
+        }
+    }
+
+private:
+    static constexpr int blockSize = 256;
+    static constexpr int numSamples = 8192;
+    static constexpr int impulsePosition = 100;
+
+    // Up and straight back down, in blocks that do not line up with the hops.
+    template <typename Signal>
+    static std::vector<float> roundTrip(int stages, Signal&& signal)
+    {
+        FftOversampler oversampler(1, stages);
+        oversampler.initProcessing((size_t)blockSize);
+
+        juce::AudioBuffer<float> buffer(1, blockSize);
+        std::vector<float> output;
+
+        for (int start = 0; start < numSamples; start += blockSize)
+        {
+            for (int n = 0; n < blockSize; ++n)
+                buffer.setSample(0, n, signal(start + n));
+
+            juce::dsp::AudioBlock<float> block(buffer);
+            oversampler.processSamplesUp(block);
+            oversampler.processSamplesDown(block);
+
+            output.insert(output.end(), buffer.getReadPointer(0), buffer.getReadPointer(0) + blockSize);
+        }
+
+        return output;
+    }
+};
+
+static FftOversamplerTest fftOversamplerTest;
+
+//==============================================================================
+class PostFilterConvolverTest : public juce::UnitTest
+{
+public:
+    PostFilterConvolverTest() : juce::UnitTest("Post-filter convolver error bound", "Distortion") {}
+
+    void runTest() override
+    {
+        // 8x 44.1 and 48 kHz, where the bench runs it.
+        for (auto sampleRate : { 352800.0, 384000.0 })
+        {
+            beginTest("Within the bound at " + juce::String(sampleRate / 1000.0) + " kHz");
+
+            for (bool movingTone : { false, true })
+            {
+                PostFilterConvolver convolver(1, sampleRate, blockSize);
+                auto error = measureError(convolver, sampleRate, movingTone);
+
+                logMessage(juce::String(movingTone ? "  moving tone: " : "  fixed tone: ") + juce::String(error)
+                           + " against " + juce::String(convolver.getErrorBound()));
+                expectLessOrEqual(error, convolver.getErrorBound() + fftRounding);
+            }
+        }
+    }
+
+private:
+    static constexpr int blockSize = 8192;
+    static constexpr int numBlocks = 16;
+    static constexpr float volume = 0.8f;
+
+    // The bound covers the dropped tail; the float FFTs add their rounding.
+    static constexpr double fftRounding = 1.0e-6;
+
+    // DF1 in double, as the convolver's responses are worked out.
+    struct ReferenceFilter
+    {
+        void setCoefficients(double B0, double B1, double B2, double A1, double A2)
+        {
+            b0 = B0; b1 = B1; b2 = B2;
+                     a1 = A1; a2 = A2;
+        }
+
+        double processSample(double x)
+        {
+            auto y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+
+            x2 = x1; x1 = x;
+            y2 = y1; y1 = y;
+
+            return y;
+        }
+
+        double b0{ 0.0 }, b1{ 0.0 }, b2{ 0.0 }, a1{ 0.0 }, a2{ 0.0 };
+        double x1{ 0.0 }, x2{ 0.0 }, y1{ 0.0 }, y2{ 0.0 };
+    };
+
+    // Largest difference from the filters on clipped noise, lined up by the latency.
+    static double measureError(PostFilterConvolver& convolver, double sampleRate, bool movingTone)
+    {
+        AnalogParameters bjtP, rcP, toneLpP, toneHpP;
+        DistortionProcessor::getConstFilterParameters(bjtP, rcP, toneLpP, toneHpP);
+
+        ReferenceFilter rc, toneLP, toneHP;
+        calculateCoefficients(rc,     rcP,     (float)sampleRate);
+        calculateCoefficients(toneLP, toneLpP, (float)sampleRate);
+        calculateCoefficients(toneHP, toneHpP, (float)sampleRate);
+
+        std::vector<float> data((size_t)blockSize), tone((size_t)blockSize);
+        std::vector<double> exact;
+        juce::Random random(7);
+
+        const auto latency = convolver.getLatencyInSamples();
+        double maxError = 0.0;
+
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            const auto start = (int)exact.size();
+
+            for (int n = 0; n < blockSize; ++n)
+            {
+                data[(size_t)n] = DistortionProcessor::clipDiodes(20.f * (random.nextFloat() * 2.f - 1.f));
+                tone[(size_t)n] = movingTone ? 0.5f + 0.5f * (float)std::sin(1.0e-4 * (start + n)) : 0.3f;
+
+                auto y = rc.processSample((double)data[(size_t)n]);
+                exact.push_back(((1 - tone[(size_t)n]) * toneLP.processSample(y) + tone[(size_t)n] * toneHP.processSample(y))
+                                * volume);
+            }
+
+            convolver.process(0, data.data(), blockSize, movingTone ? tone.data() : nullptr, 0.3f, volume);
+
+            for (int n = 0; n < blockSize; ++n)
+                if (auto delayed = start + n - latency; delayed >= 0)
+                    maxError = juce::jmax(maxError, std::abs(data[(size_t)n] - exact[(size_t)delayed]));
+        }
+
+        return maxError;
+    }
+};
+
+static PostFilterConvolverTest postFilterConvolverTest;
@@ -0,0 +1,268 @@
+/*
+  ==============================================================================
+
+    libFuzzer target for the processor and a bare DistortionProcessor, built
+    with -DDISTORTION_BUILD_FUZZER=ON by Clang (see Tools/CMakeLists.txt):
+
+        ./DistortionFuzz -max_total_time=600 corpus/
+
+    Each input picks a sample rate, a bus layout, realtime or offline, a
+    prepared block size, the parameters, then a run of blocks of any size up
+    to twice the prepared one, with parameter jumps and MIDI CCs between and
+    within them. The input samples include the odd NaN, infinity and
+    out-of-range value. Every block must
+
+      - come out finite and below maxOutputLevel, whatever went in,
+      - not allocate or free memory on the calling thread,
+      - finish within its own duration times DISTORTION_FUZZ_DEADLINE, plus
+        slackSeconds for the scheduler. The default of 4 covers the
+        sanitizers' slowdown; 0 turns the check off.
+
+    Any failure aborts with a message, leaving the input for libFuzzer.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+#include <fuzzer/FuzzedDataProvider.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+//==============================================================================
+// Counts heap calls made while a block runs on this thread. Worker threads
+// are free to allocate, so the flag is per thread.
+namespace
+{
+    thread_local bool inAudioCallback = false;
+    thread_local int numAudioAllocations = 0;
+
+    void noteAllocation()
+    {
+        if (inAudioCallback)
+            ++numAudioAllocations;
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    noteAllocation();
+
+    if (auto* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)                        { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    noteAllocation();
+    return std::malloc(size == 0 ? 1 : size);
+}
+void* operator new[](std::size_t size, const std::nothrow_t& t) noexcept { return operator new(size, t); }
+
+void operator delete(void* p) noexcept                        { if (p != nullptr) noteAllocation(); std::free(p); }
+void operator delete[](void* p) noexcept                      { operator delete(p); }
+void operator delete(void* p, std::size_t) noexcept           { operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept         { operator delete(p); }
+
+//==============================================================================
+namespace
+{
+    constexpr float maxOutputLevel = 16.f;
+    constexpr double slackSeconds = 0.002;
+    constexpr int maxBlockSize = 4096;
+    constexpr int maxBlocks = 32;
+
+    const double sampleRates[] = { 22050.0, 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0, 384000.0 };
+
+    double getDeadlineFactor()
+    {
+        static const double factor = juce::SystemStats::getEnvironmentVariable("DISTORTION_FUZZ_DEADLINE", "4").getDoubleValue();
+        return factor;
+    }
+
+    [[noreturn]] void fail(const juce::String& what)
+    {
+        std::fprintf(stderr, "DistortionFuzz: %s\n", what.toRawUTF8());
+        std::abort();
+    }
+
+    float consumeSample(FuzzedDataProvider& input)
+    {
+        switch (input.ConsumeIntegralInRange(0, 63))
+        {
+            case 0:  return std::numeric_limits<float>::quiet_NaN();
+            case 1:  return std::numeric_limits<float>::infinity();
+            case 2:  return -std::numeric_limits<float>::infinity();
+            case 3:  return input.ConsumeFloatingPointInRange(-1.0e6f, 1.0e6f);
+            case 4:  return std::numeric_limits<float>::denorm_min();
+            default: return input.ConsumeFloatingPointInRange(-1.f, 1.f);
+        }
+    }
+
+    // Runs process() as the audio thread would and checks the block it leaves.
+    template <typename Process>
+    void runBlock(Process&& process, const float* const* channels, int numChannels, int numSamples, double sampleRate)
+    {
+        inAudioCallback = true;
+        numAudioAllocations = 0;
+
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+        process();
+        const auto elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - start) * 0.001;
+
+        inAudioCallback = false;
+
+        const auto context = " in a block of " + juce::String(numSamples) + " at " + juce::String(sampleRate) + " Hz";
+
+        if (numAudioAllocations > 0)
+            fail(juce::String(numAudioAllocations) + " heap call(s)" + context);
+
+        if (auto factor = getDeadlineFactor(); factor > 0.0 && elapsedSeconds > factor * numSamples / sampleRate + slackSeconds)
+            fail(juce::String(elapsedSeconds * 1000.0, 3) + " ms" + context);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            if (!DistortionProcessor::allFinite(channels[ch], numSamples))
+                fail("non-finite output" + context);
+
+            for (int n = 0; n < numSamples; ++n)
+                if (std::abs(channels[ch][n]) > maxOutputLevel)
+                    fail("output " + juce::String(channels[ch][n]) + context);
+        }
+    }
+
+    // A bare engine at an oversampled rate, with per-sample gain and tone.
+    void fuzzEngine(FuzzedDataProvider& input)
+    {
+        const auto sampleRate = input.PickValueInArray(sampleRates) * (double)(1 << input.ConsumeIntegralInRange(0, 3));
+
+        DistortionProcessor engine;
+        engine.prepare(sampleRate);
+        engine.setPolynomial(input.ConsumeBool());
+
+        std::vector<float> samples((size_t)maxBlockSize), gain((size_t)maxBlockSize), tone((size_t)maxBlockSize);
+
+        for (int block = 0; block < maxBlocks && input.remaining_bytes() > 0; ++block)
+        {
+            DistortionParameters params;
+            params.gain   = input.ConsumeFloatingPointInRange(0.01f, 0.99f);
+            params.tone   = input.ConsumeProbability<float>();
+            params.volume = input.ConsumeProbability<float>();
+            params.envelope = input.ConsumeProbability<float>();
+            params.controlInterval = DistortionProcessor::minControlInterval << input.ConsumeIntegralInRange(0, 3);
+            engine.updateParameters(params);
+
+            const auto numSamples = input.ConsumeIntegralInRange(0, maxBlockSize);
+            const bool modulated = input.ConsumeBool();
+
+            for (int n = 0; n < numSamples; ++n)
+            {
+                samples[(size_t)n] = consumeSample(input);
+                gain[(size_t)n] = juce::jlimit(0.01f, 0.99f, params.gain + 0.1f * (float)(n % 7 - 3));
+                tone[(size_t)n] = (float)(n % 11) / 10.f;
+            }
+
+            float* channels[] = { samples.data() };
+            juce::dsp::AudioBlock<float> audioBlock(channels, 1, (size_t)numSamples);
+
+            runBlock([&] { engine.processBlock(audioBlock, modulated ? gain.data() : nullptr, modulated ? tone.data() : nullptr); },
+                     channels, 1, numSamples, sampleRate);
+        }
+    }
+
+    void fuzzProcessor(FuzzedDataProvider& input)
+    {
+        DistortionPluginAudioProcessor processor;
+
+        // Main bus mono or stereo, the sidechain and the second track on or off.
+        auto layout = processor.getBusesLayout();
+        const auto mainInput = input.ConsumeBool() ? juce::AudioChannelSet::mono() : juce::AudioChannelSet::stereo();
+        layout.getChannelSet(true, 0) = mainInput;
+
+        if (input.ConsumeBool())
+            layout.getChannelSet(true, 1) = input.ConsumeBool() ? juce::AudioChannelSet::mono() : juce::AudioChannelSet::stereo();
+
+        if (input.ConsumeBool())
+        {
+            layout.getChannelSet(true, 2)  = juce::AudioChannelSet::stereo();
+            layout.getChannelSet(false, 1) = juce::AudioChannelSet::stereo();
+        }
+
+        if (!processor.setBusesLayout(layout))
+            return;
+
+        auto& parameters = processor.getParameters();
+
+        auto jumpParameter = [&]
+        {
+            auto* parameter = parameters[input.ConsumeIntegralInRange(0, parameters.size() - 1)];
+            parameter->setValueNotifyingHost(input.ConsumeProbability<float>());
+        };
+
+        for (int i = input.ConsumeIntegralInRange(0, 8); --i >= 0;)
+            jumpParameter();
+
+        const auto sampleRate = input.PickValueInArray(sampleRates);
+        const auto preparedBlockSize = input.ConsumeIntegralInRange(1, maxBlockSize / 2);
+
+        processor.setNonRealtime(input.ConsumeBool());
+        processor.setRateAndBufferSizeDetails(sampleRate, preparedBlockSize);
+        processor.prepareToPlay(sampleRate, preparedBlockSize);
+
+        const auto numChannels = juce::jmax(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+        juce::AudioBuffer<float> buffer(numChannels, maxBlockSize);
+        juce::MidiBuffer midiMessages;
+        midiMessages.ensureSize(256);
+
+        for (int block = 0; block < maxBlocks && input.remaining_bytes() > 0; ++block)
+        {
+            // Hosts may send anything up to twice what they announced.
+            const auto numSamples = input.ConsumeIntegralInRange(0, 2 * preparedBlockSize);
+            buffer.setSize(numChannels, numSamples, false, false, true);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                for (int n = 0; n < numSamples; ++n)
+                    buffer.setSample(ch, n, consumeSample(input));
+
+            if (input.ConsumeBool())
+                jumpParameter();
+
+            midiMessages.clear();
+
+            for (int i = input.ConsumeIntegralInRange(0, 4); --i >= 0;)
+                midiMessages.addEvent(juce::MidiMessage::controllerEvent(1, input.ConsumeIntegralInRange(0, 127),
+                                                                         input.ConsumeIntegralInRange(0, 127)),
+                                      input.ConsumeIntegralInRange(0, juce::jmax(0, numSamples - 1)));
+
+            runBlock([&] { processor.processBlock(buffer, midiMessages); },
+                     buffer.getArrayOfReadPointers(), numChannels, numSamples, sampleRate);
+        }
+
+        processor.releaseResources();
+    }
+}
+
+extern "C" int LLVMFuzzerInitialize(int*, char***)
+{
+    // The parameters post their changes to the message thread.
+    static juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    FuzzedDataProvider input(data, size);
+
+    if (input.ConsumeBool())
+        fuzzEngine(input);
+    else
+        fuzzProcessor(input);
+
+    return 0;
+}
@@ -0,0 +1,245 @@
+/*
+  ==============================================================================
+
+    The SIMD lane code against what it stands in for: LaneEngine against one
+    DistortionProcessor per channel, and instances batched through the
+    InstanceBatcher against the same chain run on its own.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+namespace
+{
+    std::vector<DistortionParameters> createLaneParameters(int numLanes)
+    {
+        std::vector<DistortionParameters> parameters((size_t)numLanes);
+
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            auto& params = parameters[(size_t)lane];
+            params.gain   = 0.1f + 0.8f * (float)lane / (float)numLanes;
+            params.tone   = 1.f - (float)lane / (float)numLanes;
+            params.volume = 0.5f + 0.05f * (float)lane;
+        }
+
+        return parameters;
+    }
+
+    void fillWithNoise(juce::AudioBuffer<float>& buffer, juce::Random& random, float level)
+    {
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            for (int n = 0; n < buffer.getNumSamples(); ++n)
+                buffer.setSample(ch, n, level * (2.f * random.nextFloat() - 1.f));
+    }
+}
+
+//==============================================================================
+class LaneEngineTest : public juce::UnitTest
+{
+public:
+    LaneEngineTest() : juce::UnitTest("Lanes against the scalar chain", "Distortion") {}
+
+    void runTest() override
+    {
+        // 8x 48 kHz, with every lane group count.
+        constexpr double sampleRate = 384000.0;
+
+        for (auto numLanes : { 1, 4, 7, LaneEngine::maxLanes })
+        {
+            beginTest(juce::String(numLanes) + " lanes");
+
+            for (auto level : { 0.1f, 4.f })
+            {
+                auto errorDb = measureError(sampleRate, numLanes, level);
+                logMessage("  input level " + juce::String(level) + ": " + juce::String(errorDb, 1) + " dB");
+                expectLessThan(errorDb, maxErrorDb);
+            }
+        }
+    }
+
+private:
+    // LaneMath's curves are within float rounding of the library's, and the
+    // difference goes through the filters' feedback: some -105 dB.
+    static constexpr double maxErrorDb = -90.0;
+
+    // Error energy against signal energy, over all lanes.
+    static double measureError(double sampleRate, int numLanes, float level)
+    {
+        constexpr int numSamples = 16384;
+        const auto parameters = createLaneParameters(numLanes);
+
+        juce::AudioBuffer<float> input(numLanes, numSamples);
+        juce::Random random(3);
+        fillWithNoise(input, random, level);
+
+        juce::AudioBuffer<float> scalarOutput, laneOutput;
+        scalarOutput.makeCopyOf(input);
+        laneOutput.makeCopyOf(input);
+
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            DistortionProcessor processor;
+            processor.prepare(sampleRate);
+            processor.updateParameters(parameters[(size_t)lane]);
+
+            float* channel[] = { scalarOutput.getWritePointer(lane) };
+            juce::dsp::AudioBlock<float> block(channel, 1, (size_t)numSamples);
+            processor.processBlock(block);
+        }
+
+        LaneEngine lanes;
+        lanes.prepare(sampleRate, numLanes);
+
+        for (int lane = 0; lane < numLanes; ++lane)
+            lanes.setParameters(lane, parameters[(size_t)lane]);
+
+        lanes.process(laneOutput.getArrayOfWritePointers(), numLanes, numSamples);
+
+        double signal = 0.0, error = 0.0;
+
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            for (int n = 0; n < numSamples; ++n)
+            {
+                const auto expected = (double)scalarOutput.getSample(lane, n);
+                const auto difference = (double)laneOutput.getSample(lane, n) - expected;
+
+                signal += expected * expected;
+                error  += difference * difference;
+            }
+        }
+
+        return 10.0 * std::log10(juce::jmax(error, 1.0e-30) / signal);
+    }
+};
+
+static LaneEngineTest laneEngineTest;
+
+//==============================================================================
+class BatchingTest : public juce::UnitTest
+{
+public:
+    BatchingTest() : juce::UnitTest("Batched against solo", "Distortion") {}
+
+    void runTest() override
+    {
+        beginTest("Two instances in one batch");
+
+        // A stereo and a mono instance, each with its own parameters, fed
+        // blocks that do not line up with the rounds.
+        const auto parameters = createLaneParameters(2);
+        const int channels[] = { 2, 1 };
+
+        std::vector<std::unique_ptr<BatchedEngine>> engines;
+
+        for (int i = 0; i < 2; ++i)
+        {
+            engines.push_back(std::make_unique<BatchedEngine>(createConfig(channels[i])));
+            engines.back()->setParameters(parameters[(size_t)i]);
+            expect(engines.back()->isBatched(), "the batcher had no room");
+        }
+
+        juce::Random random(5);
+        std::vector<juce::AudioBuffer<float>> inputs, outputs;
+
+        for (int i = 0; i < 2; ++i)
+        {
+            inputs.emplace_back(channels[i], numSamples);
+            fillWithNoise(inputs.back(), random, 0.5f);
+
+            outputs.emplace_back();
+            outputs.back().makeCopyOf(inputs.back());
+        }
+
+        for (int start = 0; start < numSamples; start += hostBlockSize)
+        {
+            const auto length = juce::jmin(hostBlockSize, numSamples - start);
+
+            for (int i = 0; i < 2; ++i)
+            {
+                auto block = juce::dsp::AudioBlock<float>(outputs[(size_t)i]).getSubBlock((size_t)start, (size_t)length);
+                engines[(size_t)i]->process(block);
+            }
+        }
+
+        for (int i = 0; i < 2; ++i)
+        {
+            auto expected = renderSolo(inputs[(size_t)i], parameters[(size_t)i]);
+            float maxError = 0.f;
+
+            for (int ch = 0; ch < channels[i]; ++ch)
+                for (int n = 0; n < numSamples; ++n)
+                    maxError = juce::jmax(maxError, std::abs(outputs[(size_t)i].getSample(ch, n) - expected.getSample(ch, n)));
+
+            logMessage("  instance " + juce::String(i + 1) + ": " + juce::String(maxError));
+            expectLessThan(maxError, 1.0e-6f);
+        }
+    }
+
+private:
+    static constexpr double sampleRate = 48000.0;
+    static constexpr int roundSize = 256;
+    static constexpr int hostBlockSize = 100;
+    static constexpr int numSamples = roundSize * 16;
+
+    static EngineConfig createConfig(int numChannels)
+    {
+        EngineConfig config;
+        config.sampleRate         = sampleRate;
+        config.numChannels        = numChannels;
+        config.oversamplingStages = 2;
+        config.maxBlockSize       = roundSize;
+
+        return config;
+    }
+
+    // What BatchedEngine runs on its own: rounds through the same oversampler
+    // and lanes, handed out a round late.
+    static juce::AudioBuffer<float> renderSolo(const juce::AudioBuffer<float>& input, const DistortionParameters& params)
+    {
+        const auto config = createConfig(input.getNumChannels());
+
+        juce::dsp::Oversampling<float> oversampler((size_t)config.numChannels, (size_t)config.oversamplingStages,
+                                                   juce::dsp::Oversampling<float>::FilterType::filterHalfBandPolyphaseIIR,
+                                                   true);
+        oversampler.initProcessing((size_t)roundSize);
+
+        LaneEngine lanes;
+        lanes.prepare(sampleRate * (double)oversampler.getOversamplingFactor(), config.numChannels);
+
+        for (int lane = 0; lane < config.numChannels; ++lane)
+            lanes.setParameters(lane, params);
+
+        juce::AudioBuffer<float> output(config.numChannels, numSamples);
+        output.clear();
+
+        juce::AudioBuffer<float> round(config.numChannels, roundSize);
+
+        for (int start = 0; start + roundSize < numSamples; start += roundSize)
+        {
+            for (int ch = 0; ch < config.numChannels; ++ch)
+                round.copyFrom(ch, 0, input, ch, start, roundSize);
+
+            juce::dsp::AudioBlock<float> block(round);
+            auto oversampled = oversampler.processSamplesUp(block);
+
+            float* channels[LaneEngine::maxLanes];
+
+            for (int ch = 0; ch < config.numChannels; ++ch)
+                channels[ch] = oversampled.getChannelPointer((size_t)ch);
+
+            lanes.process(channels, config.numChannels, (int)oversampled.getNumSamples());
+            oversampler.processSamplesDown(block);
+
+            for (int ch = 0; ch < config.numChannels; ++ch)
+                output.copyFrom(ch, start + roundSize, round, ch, 0, roundSize);
+        }
+
+        return output;
+    }
+};
+
+static BatchingTest batchingTest;
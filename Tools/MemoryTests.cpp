@@ -0,0 +1,118 @@
+/*
+  ==============================================================================
+
+    Heap memory of a prepared and of an idle instance, counted by replacing
+    the global operator new and delete for the test binary.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+//==============================================================================
+// Every block carries its size in front of it, so delete knows what it frees.
+namespace
+{
+    std::atomic<std::int64_t> liveHeapBytes{ 0 };
+
+    constexpr std::size_t headerSize = alignof(std::max_align_t);
+
+    void* allocate(std::size_t size) noexcept
+    {
+        auto* block = static_cast<unsigned char*>(std::malloc(headerSize + size));
+
+        if (block == nullptr)
+            return nullptr;
+
+        *reinterpret_cast<std::size_t*>(block) = size;
+        liveHeapBytes += (std::int64_t)size;
+        return block + headerSize;
+    }
+
+    void release(void* p) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        auto* block = static_cast<unsigned char*>(p) - headerSize;
+        liveHeapBytes -= (std::int64_t)*reinterpret_cast<std::size_t*>(block);
+        std::free(block);
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    if (auto* p = allocate(size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)                                    { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept      { return allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept    { return allocate(size); }
+
+void operator delete(void* p) noexcept                                    { release(p); }
+void operator delete[](void* p) noexcept                                  { release(p); }
+void operator delete(void* p, std::size_t) noexcept                       { release(p); }
+void operator delete[](void* p, std::size_t) noexcept                     { release(p); }
+
+//==============================================================================
+class IdleMemoryTest : public juce::UnitTest
+{
+public:
+    IdleMemoryTest() : juce::UnitTest("Idle instance memory", "Distortion") {}
+
+    void runTest() override
+    {
+        for (auto sampleRate : { 48000.0, 96000.0, 192000.0 })
+        {
+            beginTest("releaseResources at " + juce::String(sampleRate / 1000.0) + " kHz");
+
+            const auto before = liveHeapBytes.load();
+
+            auto processor = std::make_unique<DistortionPluginAudioProcessor>();
+            const auto unprepared = liveHeapBytes.load() - before;
+
+            processor->setRateAndBufferSizeDetails(sampleRate, blockSize);
+            processor->prepareToPlay(sampleRate, blockSize);
+
+            const auto prepared = liveHeapBytes.load() - before;
+            const auto estimate = (std::int64_t)processor->getEngineMemoryBytes();
+
+            processor->releaseResources();
+
+            const auto idle = liveHeapBytes.load() - before;
+
+            logMessage("  prepared " + juce::String(prepared) + " bytes, idle " + juce::String(idle)
+                       + " bytes, engines estimated at " + juce::String(estimate) + " bytes");
+
+            expectEquals((std::int64_t)processor->getEngineMemoryBytes(), (std::int64_t)0);
+            expect(estimate > 0);
+
+            // Everything the estimate counts is released.
+            expect(prepared - idle >= estimate * 9 / 10, "released less than the estimate");
+
+            // Nothing is left of the engines but what the unprepared processor had.
+            expect(idle <= unprepared + slackBytes, "idle instance holds " + juce::String(idle - unprepared) + " bytes more than a new one");
+
+            processor.reset();
+        }
+    }
+
+private:
+    static constexpr int blockSize = 512;
+
+    // For the worker threads prepareToPlay starts once per process, and the
+    // odd string the processor keeps.
+    static constexpr std::int64_t slackBytes = 64 * 1024;
+};
+
+static IdleMemoryTest idleMemoryTest;
@@ -0,0 +1,220 @@
+/*
+  ==============================================================================
+
+    Timing of the modulation sources through the whole processor: a mapped
+    MIDI CC takes effect on its own sample, and the LFO's phase follows the
+    host's song position.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+namespace
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int blockSize = 256;
+
+    void setParameter(DistortionPluginAudioProcessor& processor, const juce::String& id, float value)
+    {
+        auto* parameter = processor.apvts.getParameter(id);
+        parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+    }
+
+    juce::AudioBuffer<float> createBuffer(const DistortionPluginAudioProcessor& processor)
+    {
+        return juce::AudioBuffer<float>(juce::jmax(processor.getTotalNumInputChannels(),
+                                                   processor.getTotalNumOutputChannels()), blockSize);
+    }
+
+    // A 220 Hz tone on every channel, continuing from sample start.
+    void fillWithTone(juce::AudioBuffer<float>& buffer, int start)
+    {
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            for (int n = 0; n < buffer.getNumSamples(); ++n)
+                buffer.setSample(ch, n, 0.3f * (float)std::sin(juce::MathConstants<double>::twoPi * 220.0
+                                                                * (double)(start + n) / sampleRate));
+    }
+
+    std::vector<float> getChannel(const juce::AudioBuffer<float>& buffer, int channel)
+    {
+        return { buffer.getReadPointer(channel), buffer.getReadPointer(channel) + buffer.getNumSamples() };
+    }
+}
+
+//==============================================================================
+class MidiControllerTimingTest : public juce::UnitTest
+{
+public:
+    MidiControllerTimingTest() : juce::UnitTest("MIDI CC timing", "Distortion") {}
+
+    void runTest() override
+    {
+        // The last leaves a quarter of the block for the oversampler's latency.
+        for (auto position : { 0, 1, 100, blockSize * 3 / 4 })
+        {
+            beginTest("Volume CC at sample " + juce::String(position));
+
+            // Volume is 0 up to the CC, so nothing before it may come out.
+            auto whole = render(position, blockSize);
+            auto firstSound = (int)std::distance(whole.begin(), std::find_if(whole.begin(), whole.end(),
+                                                                              [](float x) { return x != 0.f; }));
+            expectGreaterOrEqual(firstSound, position);
+            expect(firstSound < blockSize, "the CC had no effect within the block");
+
+            // The host splitting the block at the CC changes nothing.
+            auto split = render(position, position);
+            expect(whole == split, "output differs from a block split at the CC");
+        }
+    }
+
+private:
+    static constexpr int controller = 7;
+
+    // The second of two blocks, with a CC 7 (learnt for Volume in the first)
+    // turning Volume up at ccPosition, handed to the processor in two parts
+    // split at splitAt.
+    static std::vector<float> render(int ccPosition, int splitAt)
+    {
+        DistortionPluginAudioProcessor processor;
+        processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        setParameter(processor, "Volume", 0.f);
+        setParameter(processor, "MidiLearn", (float)(MidiLearn::volume + 1));
+
+        auto buffer = createBuffer(processor);
+        juce::MidiBuffer midiMessages;
+
+        // Learn the CC at the Volume there is already.
+        fillWithTone(buffer, 0);
+        midiMessages.addEvent(juce::MidiMessage::controllerEvent(1, controller, 0), 0);
+        processor.processBlock(buffer, midiMessages);
+
+        fillWithTone(buffer, blockSize);
+
+        for (auto [start, end] : { std::make_pair(0, splitAt), std::make_pair(splitAt, blockSize) })
+        {
+            if (start == end)
+                continue;
+
+            juce::AudioBuffer<float> part(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start, end - start);
+
+            midiMessages.clear();
+
+            if (ccPosition >= start && ccPosition < end)
+                midiMessages.addEvent(juce::MidiMessage::controllerEvent(1, controller, 127), ccPosition - start);
+
+            processor.processBlock(part, midiMessages);
+        }
+
+        processor.releaseResources();
+        return getChannel(buffer, 0);
+    }
+};
+
+static MidiControllerTimingTest midiControllerTimingTest;
+
+//==============================================================================
+class LfoPhaseTest : public juce::UnitTest
+{
+public:
+    LfoPhaseTest() : juce::UnitTest("LFO phase", "Distortion") {}
+
+    void runTest() override
+    {
+        // Within the 2e-4 its Taylor polynomial promises, wherever the phase starts.
+        beginTest("Lfo::generate against a sine");
+
+        for (auto phase : { 0.0, 0.3, 0.999, 17.25 })
+        {
+            for (auto increment : { 1.0e-5, 3.0e-3 })
+            {
+                constexpr int numSamples = 4096;
+                std::vector<float> lfo(numSamples);
+                Lfo::generate(lfo.data(), numSamples, phase, increment);
+
+                float maxError = 0.f;
+
+                for (int n = 0; n < numSamples; ++n)
+                    maxError = juce::jmax(maxError, std::abs(lfo[(size_t)n] - (float)std::sin(juce::MathConstants<double>::twoPi
+                                                                                               * (phase + n * increment))));
+
+                expectLessThan(maxError, 2.0e-4f);
+            }
+        }
+
+        // LfoRate 1/4 is one cycle per beat, so two beats on the phase is the same.
+        beginTest("Phase follows the song position");
+
+        auto atStart = render(0.0);
+        auto twoBeatsOn = render(2.0);
+        auto halfBeatOn = render(0.5);
+
+        float sameCycle = 0.f, halfCycle = 0.f;
+
+        for (size_t n = 0; n < atStart.size(); ++n)
+        {
+            sameCycle = juce::jmax(sameCycle, std::abs(twoBeatsOn[n] - atStart[n]));
+            halfCycle = juce::jmax(halfCycle, std::abs(halfBeatOn[n] - atStart[n]));
+        }
+
+        logMessage("  two beats on " + juce::String(sameCycle) + ", half a beat on " + juce::String(halfCycle));
+
+        expectLessThan(sameCycle, 1.0e-5f);
+        expectGreaterThan(halfCycle, 1.0e-2f);
+    }
+
+private:
+    struct PlayingHead : juce::AudioPlayHead
+    {
+        juce::Optional<PositionInfo> getPosition() const override
+        {
+            PositionInfo info;
+            info.setBpm(bpm);
+            info.setPpqPosition(ppq);
+            info.setIsPlaying(true);
+            return info;
+        }
+
+        double bpm{ 120.0 };
+        double ppq{ 0.0 };
+    };
+
+    // A second of the tone with full LFO depth on Gain, played from startPpq.
+    static std::vector<float> render(double startPpq)
+    {
+        DistortionPluginAudioProcessor processor;
+        processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        setParameter(processor, "LfoRate", 2.f);
+        setParameter(processor, "LfoGain", 0.5f);
+
+        PlayingHead playHead;
+        playHead.ppq = startPpq;
+        processor.setPlayHead(&playHead);
+
+        auto buffer = createBuffer(processor);
+        juce::MidiBuffer midiMessages;
+        std::vector<float> output;
+
+        for (int start = 0; start < (int)sampleRate; start += blockSize)
+        {
+            fillWithTone(buffer, start);
+            processor.processBlock(buffer, midiMessages);
+
+            auto channel = getChannel(buffer, 0);
+            output.insert(output.end(), channel.begin(), channel.end());
+
+            playHead.ppq += blockSize / sampleRate * playHead.bpm / 60.0;
+        }
+
+        processor.setPlayHead(nullptr);
+        processor.releaseResources();
+        return output;
+    }
+};
+
+static LfoPhaseTest lfoPhaseTest;
@@ -0,0 +1,398 @@
+/*
+  ==============================================================================
+
+    An experiment kept for the benchmarks, not part of the plugin: the RC
+    and tone stages after the clipper as FFT convolution, measured against
+    the biquads at the highest internal rates. With JUCE's FFT it is some
+    25 times slower than the biquads at 8x 44.1 and 48 kHz, and even a fast
+    FFT would need about two of them per hop, roughly what the biquads cost
+    for the same samples.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+#include <complex>
+#include <vector>
+
+// The RC and tone stages after the clipper as two FIR filters: the impulse
+// responses of RC into the tone low-pass and RC into the tone high-pass, cut
+// off where the rest could move the output by no more than maxError, and
+// applied by overlap-save FFT convolution. Neither clipping curve leaves
+// +-aDiode pi / 2, so that bound is aDiode pi / 2 times the L1 norm of the
+// dropped tail; tone and volume only scale it down. The FFTs' own rounding
+// comes on top, around -140 dB, well below what the float biquads lose. Tone
+// and volume weight the two outputs per sample, as in the IIR stages, and
+// while they hold still over a hop the spectra are mixed instead, so that
+// one inverse FFT does. The output comes a hop (numTaps samples) late.
+class PostFilterConvolver
+{
+public:
+    static constexpr double maxError = 1.0e-5;
+    static constexpr int minTaps = 64;
+    static constexpr int maxTaps = 1 << 15;
+
+    PostFilterConvolver(int channels, double sampleRate, int maxBlockSize)
+        : numChannels(channels),
+          numTaps(getNumTaps(sampleRate)),
+          fft(getFftOrder(numTaps))
+    {
+        // No length reaches maxError at this rate; see getNumTaps.
+        jassert(numTaps > 0);
+
+        const auto size = 2 * numTaps;
+
+        std::vector<double> lowPassed, highPassed;
+        computeResponses(sampleRate, lowPassed, highPassed);
+        errorBound = getTailBound(lowPassed, highPassed, numTaps);
+
+        auto toSpectrum = [&](const std::vector<double>& response, std::vector<Complex>& spectrum)
+        {
+            for (int n = 0; n < numTaps; ++n)
+                work[(size_t)n] = (float)response[(size_t)n];
+
+            std::fill(work.begin() + numTaps, work.end(), 0.f);
+            fft.performRealOnlyForwardTransform(work.data(), true);
+
+            spectrum.resize((size_t)numTaps + 1);
+
+            for (size_t k = 0; k < spectrum.size(); ++k)
+                spectrum[k] = { work[2 * k], work[2 * k + 1] };
+        };
+
+        work.resize((size_t)size * 2);
+        highWork.resize((size_t)size * 2);
+
+        toSpectrum(lowPassed,  lowSpectrum);
+        toSpectrum(highPassed, highSpectrum);
+
+        input.setSize(numChannels, size);
+        lowWeights.setSize(numChannels, numTaps);
+        highWeights.setSize(numChannels, numTaps);
+        output.setSize(numChannels, numTaps + maxBlockSize);
+        fill.resize((size_t)numChannels);
+        available.resize((size_t)numChannels);
+
+        reset();
+    }
+
+    // The shortest power-of-two length whose dropped tail stays within
+    // maxError, or 0 if even maxTaps leave more; the biquads run then.
+    static int getNumTaps(double sampleRate)
+    {
+        std::vector<double> lowPassed, highPassed;
+        computeResponses(sampleRate, lowPassed, highPassed);
+
+        for (int taps = minTaps; taps <= maxTaps; taps *= 2)
+            if (getTailBound(lowPassed, highPassed, taps) <= maxError)
+                return taps;
+
+        return 0;
+    }
+
+    // In base-rate samples, for oversampling by 2^stages; 0 where getNumTaps is.
+    static int getLatencyInSamples(double sampleRate, int stages)
+    {
+        return getNumTaps(sampleRate * (double)(1 << stages)) >> stages;
+    }
+
+    void reset()
+    {
+        for (auto* buffer : { &input, &lowWeights, &highWeights, &output })
+            buffer->clear();
+
+        std::fill(fill.begin(), fill.end(), numTaps);
+        std::fill(available.begin(), available.end(), numTaps);
+    }
+
+    int getLatencyInSamples() const { return numTaps; }
+    double getErrorBound() const    { return errorBound; }
+
+    size_t getAllocatedBytes() const
+    {
+        size_t samples = work.size() + highWork.size() + (lowSpectrum.size() + highSpectrum.size()) * 2;
+
+        for (auto* buffer : { &input, &lowWeights, &highWeights, &output })
+            samples += (size_t)buffer->getNumChannels() * (size_t)buffer->getNumSamples();
+
+        return samples * sizeof(float) + (fill.size() + available.size()) * sizeof(int);
+    }
+
+    // Replaces the clipper output in data by the tone stage output, numTaps
+    // samples late. tone, if not nullptr, holds per-sample tone values that
+    // override toneValue.
+    void process(int channel, float* data, int numSamples, const float* tone, float toneValue, float volume)
+    {
+        auto& channelFill = fill[(size_t)channel];
+        auto& channelAvailable = available[(size_t)channel];
+
+        for (int done = 0; done < numSamples;)
+        {
+            const auto length = juce::jmin(numSamples - done, 2 * numTaps - channelFill);
+            const auto offset = channelFill - numTaps;
+
+            std::copy(data + done, data + done + length, input.getWritePointer(channel, channelFill));
+
+            auto* low  = lowWeights.getWritePointer(channel, offset);
+            auto* high = highWeights.getWritePointer(channel, offset);
+
+            for (int n = 0; n < length; ++n)
+            {
+                auto t = tone != nullptr ? tone[done + n] : toneValue;
+                low[n]  = (1.f - t) * volume;
+                high[n] = t * volume;
+            }
+
+            channelFill += length;
+            done += length;
+
+            if (channelFill == 2 * numTaps)
+            {
+                convolveHop(channel, channelAvailable);
+                channelAvailable += numTaps;
+                channelFill = numTaps;
+            }
+        }
+
+        auto* fifo = output.getWritePointer(channel);
+        std::copy(fifo, fifo + numSamples, data);
+        std::copy(fifo + numSamples, fifo + channelAvailable, fifo);
+        channelAvailable -= numSamples;
+    }
+
+   #if defined (DISTORTION_ENABLE_PERF_COUNTERS) && DISTORTION_ENABLE_PERF_COUNTERS
+    // Times this against the RC and tone biquads, sample by sample, on
+    // clipped noise at sampleRate, and logs how far each strays from the
+    // same filters run in double, next to the bound.
+    static void runBenchmarks(double sampleRate, int blockSize)
+    {
+        constexpr int numRuns = 64;
+        constexpr float tone = 0.3f, volume = 1.f;
+
+        const auto suffix = "/" + juce::String(juce::roundToInt(sampleRate / 1000.0)) + "k";
+
+        PostFilterConvolver convolver(1, sampleRate, blockSize);
+
+        AnalogParameters bjtP, rcP, toneLpP, toneHpP;
+        DistortionProcessor::getConstFilterParameters(bjtP, rcP, toneLpP, toneHpP);
+
+        Biquad rc, toneLP, toneHP;
+        calculateCoefficients(rc,     rcP,     (float)sampleRate);
+        calculateCoefficients(toneLP, toneLpP, (float)sampleRate);
+        calculateCoefficients(toneHP, toneHpP, (float)sampleRate);
+
+        ResponseFilter rcExact, toneLpExact, toneHpExact;
+        calculateCoefficients(rcExact,     rcP,     (float)sampleRate);
+        calculateCoefficients(toneLpExact, toneLpP, (float)sampleRate);
+        calculateCoefficients(toneHpExact, toneHpP, (float)sampleRate);
+
+        std::vector<float> clipped((size_t)blockSize), iirOutput((size_t)blockSize), fftOutput((size_t)blockSize);
+        std::vector<double> exact;
+        juce::Random random(0x5eed);
+
+        auto& iirSection = PerfRegistry::getInstance().getSection("postFilter/iir" + suffix);
+        auto& fftSection = PerfRegistry::getInstance().getSection("postFilter/fft" + suffix);
+
+        const auto latency = convolver.getLatencyInSamples();
+        double iirError = 0.0, fftError = 0.0;
+
+        for (int r = 0; r < numRuns; ++r)
+        {
+            for (auto& x : clipped)
+                x = DistortionProcessor::clipDiodes(20.f * (random.nextFloat() * 2.f - 1.f));
+
+            std::copy(clipped.begin(), clipped.end(), iirOutput.begin());
+            std::copy(clipped.begin(), clipped.end(), fftOutput.begin());
+
+            {
+                const ScopedPerfMeasurement measurement(&iirSection);
+
+                for (auto& x : iirOutput)
+                {
+                    auto y = rc.processSample(x);
+                    x = ((1 - tone) * toneLP.processSample(y) + tone * toneHP.processSample(y)) * volume;
+                }
+            }
+
+            {
+                const ScopedPerfMeasurement measurement(&fftSection);
+                convolver.process(0, fftOutput.data(), blockSize, nullptr, tone, volume);
+            }
+
+            const auto start = (int)exact.size();
+
+            for (int n = 0; n < blockSize; ++n)
+            {
+                auto y = rcExact.processSample((double)clipped[(size_t)n]);
+                exact.push_back(((1 - tone) * toneLpExact.processSample(y) + tone * toneHpExact.processSample(y)) * volume);
+
+                iirError = juce::jmax(iirError, std::abs(iirOutput[(size_t)n] - exact.back()));
+
+                if (auto delayed = start + n - latency; delayed >= 0)
+                    fftError = juce::jmax(fftError, std::abs(fftOutput[(size_t)n] - exact[(size_t)delayed]));
+            }
+        }
+
+        auto toDb = [](double x) { return 20.0 * std::log10(juce::jmax(1.0e-12, x)); };
+
+        juce::Logger::writeToLog("postFilter" + suffix + ": " + juce::String(latency) + " taps, error "
+                                 + juce::String(toDb(fftError), 1) + " dB (bound "
+                                 + juce::String(toDb(convolver.getErrorBound()), 1) + " dB), biquads "
+                                 + juce::String(toDb(iirError), 1) + " dB");
+    }
+   #endif
+
+private:
+    using Complex = std::complex<float>;
+
+    // Long enough that the responses have decayed to nothing.
+    static constexpr int responseLength = 4 * maxTaps;
+
+    static int getFftOrder(int taps)
+    {
+        int order = 1;
+
+        while ((1 << order) < 2 * taps)
+            ++order;
+
+        return order;
+    }
+
+    // The same digital filters as the Biquads, run in double: in float, the
+    // tone low-pass's response settles on a constant instead of decaying.
+    struct ResponseFilter
+    {
+        void setCoefficients(double B0, double B1, double B2, double A1, double A2)
+        {
+            b0 = B0; b1 = B1; b2 = B2;
+                     a1 = A1; a2 = A2;
+        }
+
+        double processSample(double x)
+        {
+            auto y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+
+            x2 = x1; x1 = x;
+            y2 = y1; y1 = y;
+
+            return y;
+        }
+
+        double b0{ 0.0 }, b1{ 0.0 }, b2{ 0.0 }, a1{ 0.0 }, a2{ 0.0 };
+        double x1{ 0.0 }, x2{ 0.0 }, y1{ 0.0 }, y2{ 0.0 };
+    };
+
+    static void computeResponses(double sampleRate, std::vector<double>& lowPassed, std::vector<double>& highPassed)
+    {
+        AnalogParameters bjtP, rcP, toneLpP, toneHpP;
+        DistortionProcessor::getConstFilterParameters(bjtP, rcP, toneLpP, toneHpP);
+
+        ResponseFilter rc, toneLP, toneHP;
+        calculateCoefficients(rc,     rcP,     (float)sampleRate);
+        calculateCoefficients(toneLP, toneLpP, (float)sampleRate);
+        calculateCoefficients(toneHP, toneHpP, (float)sampleRate);
+
+        lowPassed.assign((size_t)responseLength, 0.0);
+        lowPassed[0] = 1.0;
+
+        for (auto& x : lowPassed)
+            x = rc.processSample(x);
+
+        highPassed = lowPassed;
+
+        for (auto& x : lowPassed)
+            x = toneLP.processSample(x);
+
+        for (auto& x : highPassed)
+            x = toneHP.processSample(x);
+    }
+
+    static double getTailBound(const std::vector<double>& lowPassed, const std::vector<double>& highPassed, int taps)
+    {
+        double lowTail = 0.0, highTail = 0.0;
+
+        for (size_t n = (size_t)taps; n < lowPassed.size(); ++n)
+        {
+            lowTail  += std::abs(lowPassed[n]);
+            highTail += std::abs(highPassed[n]);
+        }
+
+        return DistortionProcessor::aDiode * juce::MathConstants<double>::halfPi * juce::jmax(lowTail, highTail);
+    }
+
+    void convolveHop(int channel, int offset)
+    {
+        const auto size = 2 * numTaps;
+        auto* segment = input.getWritePointer(channel);
+        const auto* low  = lowWeights.getReadPointer(channel);
+        const auto* high = highWeights.getReadPointer(channel);
+
+        std::copy(segment, segment + size, work.begin());
+        fft.performRealOnlyForwardTransform(work.data(), true);
+
+        const bool steady = std::all_of(low,  low  + numTaps, [&](float w) { return w == low[0]; })
+                         && std::all_of(high, high + numTaps, [&](float w) { return w == high[0]; });
+
+        auto* fifo = output.getWritePointer(channel, offset);
+
+        // The first numTaps samples of each result are wrapped around.
+        if (steady)
+        {
+            for (int k = 0; k <= numTaps; ++k)
+            {
+                auto y = Complex(work[(size_t)(2 * k)], work[(size_t)(2 * k + 1)])
+                       * (low[0] * lowSpectrum[(size_t)k] + high[0] * highSpectrum[(size_t)k]);
+                work[(size_t)(2 * k)]     = y.real();
+                work[(size_t)(2 * k + 1)] = y.imag();
+            }
+
+            FftOversampler::mirror(work.data(), size);
+            fft.performRealOnlyInverseTransform(work.data());
+
+            std::copy(work.begin() + numTaps, work.begin() + size, fifo);
+        }
+        else
+        {
+            for (int k = 0; k <= numTaps; ++k)
+            {
+                auto x = Complex(work[(size_t)(2 * k)], work[(size_t)(2 * k + 1)]);
+                auto yLow  = x * lowSpectrum[(size_t)k];
+                auto yHigh = x * highSpectrum[(size_t)k];
+                work[(size_t)(2 * k)]         = yLow.real();
+                work[(size_t)(2 * k + 1)]     = yLow.imag();
+                highWork[(size_t)(2 * k)]     = yHigh.real();
+                highWork[(size_t)(2 * k + 1)] = yHigh.imag();
+            }
+
+            FftOversampler::mirror(work.data(), size);
+            FftOversampler::mirror(highWork.data(), size);
+            fft.performRealOnlyInverseTransform(work.data());
+            fft.performRealOnlyInverseTransform(highWork.data());
+
+            for (int n = 0; n < numTaps; ++n)
+                fifo[n] = low[n] * work[(size_t)(numTaps + n)] + high[n] * highWork[(size_t)(numTaps + n)];
+        }
+
+        std::copy(segment + numTaps, segment + size, segment);
+    }
+
+    const int numChannels;
+    const int numTaps;
+
+    juce::dsp::FFT fft;
+    std::vector<Complex> lowSpectrum, highSpectrum;
+    std::vector<float> work, highWork;
+    double errorBound{ 0.0 };
+
+    // Per channel: the input segment, the previous hop in front of the new
+    // samples; tone and volume as weights for the new samples; and the
+    // output FIFO, primed with a hop of silence.
+    juce::AudioBuffer<float> input, lowWeights, highWeights, output;
+    std::vector<int> fill, available;
+
+    JUCE_DECLARE_NON_COPYABLE(PostFilterConvolver)
+};
@@ -0,0 +1,25 @@
+/*
+  ==============================================================================
+
+    Runs every juce::UnitTest in the "Distortion" category and exits with 1 if
+    any of them failed. Registered with CTest by Tools/CMakeLists.txt.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+
+int main()
+{
+    const juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runTestsInCategory("Distortion");
+
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        if (runner.getResult(i)->failures > 0)
+            return 1;
+
+    return 0;
+}